@@ -1,61 +1,399 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
-#define BUF_SIZE   255
-#define LABLE_SIZE 255
-#define MAP_SIZE   255
+// binary object file (-b), read by tomasulo: "TMOB", version, segment count,
+// then per segment kind, load address, word count and file offset, then the
+// segment contents. All fields are 4 byte little endian words.
+#define OBJ_MAGIC    "TMOB"
+#define OBJ_VERSION  1
+#define SEG_CODE     1
+#define CODE_ADDRESS 16  // tomasulo starts executing at address 16
 
-#define REG_LEN  5
-#define IMM_LEN  16
-#define ADDR_LEN 26
+#define NUM_REGS 32
+#define IMM_MIN  -32768  // immediates are 16 bits, written either signed or unsigned
+#define IMM_MAX  65535
+#define IMM_BITS 16      // branch offset
+#define ADDR_BITS 26     // jump offset
 
-#define LW_OPCODE   "100011"
-#define SW_OPCODE   "101011"
-#define ADD_OPCODE  "000000"
-#define ADDI_OPCODE "001000"
-#define SUB_OPCODE  "000000"
-#define AND_OPCODE  "000000"
-#define ANDI_OPCODE "001100"
-#define BEQZ_OPCODE "000100"
-#define J_OPCODE    "000010"
-#define HALT_OPCODE "000001"
-#define NOOP_OPCODE "000011"
+// operand formats
+enum { FMT_R, FMT_I, FMT_BRANCH, FMT_JUMP, FMT_JR, FMT_NONE };
 
-#define ADD_FUNC "00000100000"
-#define SUB_FUNC "00000100010"
-#define AND_FUNC "00000100100"
+typedef struct {
+    const char *name;
+    int format;
+    unsigned int opcode;  // 6 bits
+    unsigned int func;    // 11 bits, register-register ALU instructions only
+} opInfo;
 
-void decToBin(int dec, char *buffer, int buffer_size) {
-    buffer += buffer_size;
-    *buffer-- = '\0';
-    for (int i = buffer_size - 1; 0 <= i; i--) {
-        *buffer-- = (dec & 1) + '0';
-        dec >>= 1;
+const opInfo ops[] = {
+    // register-register ALU instructions: op rd,rs1,rs2
+    {"add", FMT_R, 0x00, 0x20}, {"sub", FMT_R, 0x00, 0x22}, {"and", FMT_R, 0x00, 0x24},
+    {"or", FMT_R, 0x00, 0x25},  {"xor", FMT_R, 0x00, 0x26}, {"slt", FMT_R, 0x00, 0x2a},
+    {"sll", FMT_R, 0x00, 0x04}, {"srl", FMT_R, 0x00, 0x06}, {"mul", FMT_R, 0x00, 0x18},
+    {"div", FMT_R, 0x00, 0x1a},
+    // immediate instructions: op rd,rs1,imm
+    {"lw", FMT_I, 0x23, 0},   {"sw", FMT_I, 0x2b, 0},   {"addi", FMT_I, 0x08, 0},
+    {"andi", FMT_I, 0x0c, 0}, {"ori", FMT_I, 0x0d, 0},  {"xori", FMT_I, 0x0e, 0},
+    {"slti", FMT_I, 0x0a, 0}, {"slli", FMT_I, 0x14, 0}, {"srli", FMT_I, 0x16, 0},
+    // op rs1,label
+    {"beqz", FMT_BRANCH, 0x04, 0}, {"bnez", FMT_BRANCH, 0x05, 0},
+    // op label
+    {"j", FMT_JUMP, 0x02, 0}, {"jal", FMT_JUMP, 0x13, 0},
+    // op rs1
+    {"jr", FMT_JR, 0x12, 0},
+    {"halt", FMT_NONE, 0x01, 0}, {"noop", FMT_NONE, 0x03, 0},
+};
+#define NUM_OPS (sizeof(ops) / sizeof(ops[0]))
+
+// Mnemonics and labels share one open-addressing hash table, so each word at
+// the start of a line is classified with a single lookup. Names point into
+// the source buffer, which stays in memory until the output is written.
+typedef struct {
+    const char *name;
+    int length;
+    const opInfo *op;  // NULL for a label
+    int address;       // -1 while the label is undefined
+    int line;          // line of the definition
+} symbol;
+
+typedef struct {
+    int address;  // instruction to patch
+    int symbol;
+    int bits;     // width of the offset field
+    int line;
+} fixup;
+
+symbol *symbols;
+int numSymbols, symbolCapacity;
+int *slots;  // indexes into symbols, -1 when empty; the size is a power of two
+int numSlots;
+
+fixup *fixups;
+int numFixups, fixupCapacity;
+
+unsigned int *code;
+int numCode, codeCapacity;
+
+const char *sourcePath;
+int errors;
+
+void report(const char *kind, int line, const char *format, va_list args) {
+    printf("%s: %s:%d: ", kind, sourcePath, line);
+    vprintf(format, args);
+    printf("\n");
+}
+
+void error(int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    report("error", line, format, args);
+    va_end(args);
+    errors++;
+}
+
+void warning(int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    report("warning", line, format, args);
+    va_end(args);
+}
+
+// makes room for one more element
+void *grow(void *array, int count, int *capacity, size_t size) {
+    if (count < *capacity) {
+        return array;
     }
+    *capacity = *capacity ? 2 * *capacity : 1024;
+    array = realloc(array, *capacity * size);
+    if (array == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+unsigned int hash(const char *name, int length) {
+    unsigned int h = 2166136261u;  // FNV-1a
+    for (int i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
 }
 
-int binToDec(char *bin) {
-    int dec = 0;
-    for (int i = 0; i < 31; i++) {
-        dec += bin[i] - '0';
-        dec <<= 1;
+void rehash(int size) {
+    free(slots);
+    slots = malloc(size * sizeof(int));
+    if (slots == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    memset(slots, -1, size * sizeof(int));
+    numSlots = size;
+    for (int i = 0; i < numSymbols; i++) {
+        unsigned int s = hash(symbols[i].name, symbols[i].length) & (size - 1);
+        while (slots[s] != -1) {
+            s = (s + 1) & (size - 1);
+        }
+        slots[s] = i;
     }
-    dec += bin[31] - '0';
-    return dec;
 }
 
-int id = 0;
-struct labelToAddr {
-    char label[LABLE_SIZE];
-    int address;
-} map[MAP_SIZE];
+// returns the index of name in symbols, adding an undefined label if it is new
+int intern(const char *name, int length) {
+    unsigned int s = hash(name, length) & (numSlots - 1);
+    for (; slots[s] != -1; s = (s + 1) & (numSlots - 1)) {
+        symbol *sym = &symbols[slots[s]];
+        if (sym->length == length && memcmp(sym->name, name, length) == 0) {
+            return slots[s];
+        }
+    }
+    symbols = grow(symbols, numSymbols, &symbolCapacity, sizeof(symbol));
+    symbols[numSymbols] = (symbol){name, length, NULL, -1, 0};
+    slots[s] = numSymbols++;
+    if (2 * numSymbols > numSlots) {  // keep the table at most half full
+        rehash(2 * numSlots);
+    }
+    return numSymbols - 1;
+}
+
+int isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// a word ends at white space, a comma or a comment
+int isWordEnd(char c) {
+    return c == '\0' || isSpace(c) || c == ',' || c == ';';
+}
+
+void skipSpace(char **p) {
+    while (isSpace(**p)) {
+        (*p)++;
+    }
+}
+
+// returns the length of the next word, 0 if there is none
+int word(char **p, const char **start) {
+    skipSpace(p);
+    *start = *p;
+    while (!isWordEnd(**p)) {
+        (*p)++;
+    }
+    return *p - *start;
+}
+
+// the rest of the line is empty or a ';' comment
+int atEnd(char *p) {
+    skipSpace(&p);
+    return *p == '\0' || *p == ';';
+}
+
+int comma(char **p, int line) {
+    skipSpace(p);
+    if (**p != ',') {
+        error(line, "expected ','");
+        return 0;
+    }
+    (*p)++;
+    return 1;
+}
+
+int reg(char **p, int line, unsigned int *r) {
+    skipSpace(p);
+    char *end;
+    if ((**p != 'r' && **p != 'R') || (*p)[1] < '0' || (*p)[1] > '9') {
+        error(line, "expected a register");
+        return 0;
+    }
+    long n = strtol(*p + 1, &end, 10);
+    if (n >= NUM_REGS || !isWordEnd(*end)) {
+        const char *name;
+        int length = word(p, &name);
+        error(line, "bad register %.*s", length, name);
+        return 0;
+    }
+    *p = end;
+    *r = n;
+    return 1;
+}
+
+int immediate(char **p, int line, unsigned int *imm) {
+    skipSpace(p);
+    char *end;
+    long n = strtol(*p, &end, 10);
+    if ((**p == 'r' || **p == 'R') && end == *p) {
+        // the old assembler read any operand with atoi, so "addi r1,r1,r2" meant "addi r1,r1,0"
+        const char *name;
+        int length = word(p, &name);
+        warning(line, "register %.*s used as an immediate, assembled as 0", length, name);
+        *imm = 0;
+        return 1;
+    }
+    if (end == *p || !isWordEnd(*end)) {
+        error(line, "expected an immediate");
+        return 0;
+    }
+    if (n < IMM_MIN || n > IMM_MAX) {
+        error(line, "immediate %ld does not fit in 16 bits", n);
+        return 0;
+    }
+    *p = end;
+    *imm = n & 0xffff;
+    return 1;
+}
+
+// offsets are relative to the instruction after the branch or jump
+void patch(int address, int target, int bits, int line) {
+    int offset = target - address - 1;
+    if (offset < -(1 << (bits - 1)) || offset >= 1 << (bits - 1)) {
+        error(line, "branch target out of range (offset %d)", offset);
+        return;
+    }
+    code[address] |= offset & ((1u << bits) - 1);
+}
+
+// patches the label into the instruction now if it is already defined,
+// otherwise when the whole source has been read
+int reference(char **p, int line, int bits) {
+    const char *name;
+    int length = word(p, &name);
+    if (length == 0) {
+        error(line, "expected a label");
+        return 0;
+    }
+    int s = intern(name, length);
+    if (symbols[s].op != NULL) {
+        error(line, "expected a label, got instruction %.*s", length, name);
+        return 0;
+    }
+    if (symbols[s].address != -1) {
+        patch(numCode, symbols[s].address, bits, line);
+    } else {
+        fixups = grow(fixups, numFixups, &fixupCapacity, sizeof(fixup));
+        fixups[numFixups++] = (fixup){numCode, s, bits, line};
+    }
+    return 1;
+}
+
+void assembleLine(char *p, int line) {
+    const char *name;
+    int length = word(&p, &name);
+    if (length == 0) {  // blank or comment only
+        if (!atEnd(p)) {
+            error(line, "unexpected '%c'", *p);
+        }
+        return;
+    }
+    int colon = length > 1 && name[length - 1] == ':';  // optional after a label
+    int s = intern(name, length - colon);
+    // anything that is not a mnemonic at the start of a line is a label
+    if (symbols[s].op == NULL || colon) {
+        int label = s;
+        if (symbols[label].op != NULL) {
+            error(line, "instruction %.*s used as a label", length - colon, name);
+            return;
+        }
+        if (symbols[label].address != -1) {
+            error(line, "duplicate label %.*s, first defined on line %d", length - colon, name,
+                  symbols[label].line);
+        } else {
+            symbols[label].address = numCode;
+            symbols[label].line = line;
+        }
+        const char *labelName = name;
+        int labelLength = length - colon;
+        length = word(&p, &name);
+        if (length == 0) {  // label on a line of its own refers to the next instruction
+            if (!atEnd(p)) {
+                error(line, "unexpected '%c'", *p);
+            }
+            return;
+        }
+        s = intern(name, length);
+        if (symbols[s].op == NULL) {
+            if (*p == ',' && !colon) {  // "ad r1,r2,r3": the first word is a misspelled mnemonic
+                name = labelName;
+                length = labelLength;
+                if (symbols[label].line == line) {
+                    symbols[label].address = -1;
+                }
+            }
+            error(line, "unknown instruction %.*s", length, name);
+            return;
+        }
+    }
+
+    const opInfo *op = symbols[s].op;
+    unsigned int rd = 0, rs1 = 0, rs2 = 0, imm = 0;
+    int ok = 1;
+    code = grow(code, numCode, &codeCapacity, sizeof(unsigned int));
+    code[numCode] = op->opcode << 26;
+    switch (op->format) {
+    case FMT_R:
+        ok = reg(&p, line, &rd) && comma(&p, line) && reg(&p, line, &rs1) && comma(&p, line) &&
+             reg(&p, line, &rs2);
+        code[numCode] |= rs1 << 21 | rs2 << 16 | rd << 11 | op->func;
+        break;
+    case FMT_I:
+        ok = reg(&p, line, &rd) && comma(&p, line) && reg(&p, line, &rs1) && comma(&p, line) &&
+             immediate(&p, line, &imm);
+        code[numCode] |= rs1 << 21 | rd << 16 | imm;
+        break;
+    case FMT_BRANCH:
+        ok = reg(&p, line, &rs1) && comma(&p, line) && reference(&p, line, IMM_BITS);
+        code[numCode] |= rs1 << 21;
+        break;
+    case FMT_JUMP:
+        ok = reference(&p, line, ADDR_BITS);
+        break;
+    case FMT_JR:
+        ok = reg(&p, line, &rs1);
+        code[numCode] |= rs1 << 21;
+        break;
+    }
+    if (ok && !atEnd(p)) {
+        skipSpace(&p);
+        error(line, "unexpected '%c' after %s operands", *p, op->name);
+    }
+    numCode++;
+}
+
+// reads the whole file; the result is NUL terminated
+char *readSource(FILE *fin) {
+    size_t size = 0, capacity = 1 << 16;
+    char *source = malloc(capacity);
+    size_t n;
+    while (source != NULL && (n = fread(source + size, 1, capacity - size - 1, fin)) > 0) {
+        size += n;
+        if (size + 1 == capacity) {
+            capacity *= 2;
+            source = realloc(source, capacity);
+        }
+    }
+    if (source == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    source[size] = '\0';
+    return source;
+}
+
+void putWord(FILE *fout, unsigned int word) {
+    for (int i = 0; i < 4; i++) {
+        fputc((word >> (8 * i)) & 0xff, fout);
+    }
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("error: usage: %s <assemble-code file> <machine-code file>\n", argv[0]);
+    int object = argc == 4 && strcmp(argv[1], "-b") == 0;
+    if (argc != 3 && !object) {
+        printf("error: usage: %s [-b] <assemble-code file> <machine-code file>\n", argv[0]);
         exit(0);
     }
+    if (object) {  // -b: write a binary object file instead of one decimal word per line
+        argv++;
+    }
 
     // read assemble-code file
     FILE *fin, *fout;
@@ -65,127 +403,67 @@ int main(int argc, char *argv[]) {
         perror("fopen");
         exit(1);
     }
+    sourcePath = argv[1];
+    char *source = readSource(fin);
+    fclose(fin);
 
-    int address = 0;
-    char buf[BUF_SIZE];
-    while (fgets(buf, BUF_SIZE, fin)) {
-        char *op = strtok(buf, " \n\r");
-        if (strcmp(op, "lw") != 0 && strcmp(op, "sw") != 0 && strcmp(op, "add") != 0 &&
-            strcmp(op, "addi") != 0 && strcmp(op, "sub") != 0 && strcmp(op, "and") != 0 &&
-            strcmp(op, "andi") != 0 && strcmp(op, "beqz") != 0 && strcmp(op, "j") != 0 &&
-            strcmp(op, "halt") != 0 && strcmp(op, "noop") != 0) {
-            strcpy(map[id].label, op);
-            map[id++].address = address;
-        }
-        address++;
+    rehash(64);
+    for (int i = 0; i < (int)NUM_OPS; i++) {
+        int s = intern(ops[i].name, strlen(ops[i].name));
+        symbols[s].op = &ops[i];
     }
 
-    fclose(fin);
-
-    fin = fopen(argv[1], "r");
-    fout = fopen("tmp.txt", "w");
-
-    address = 0;
-    while (fgets(buf, BUF_SIZE, fin)) {
-        printf("%s", buf);
-        char *op = strtok(buf, " \n\r");
-        if (strcmp(op, "lw") != 0 && strcmp(op, "sw") != 0 && strcmp(op, "add") != 0 &&
-            strcmp(op, "addi") != 0 && strcmp(op, "sub") != 0 && strcmp(op, "and") != 0 &&
-            strcmp(op, "andi") != 0 && strcmp(op, "beqz") != 0 && strcmp(op, "j") != 0 &&
-            strcmp(op, "halt") != 0 && strcmp(op, "noop") != 0) {
-            op = strtok(NULL, " \n\r");
+    // one pass over the source; labels used before their definition are left as fixups
+    int line = 1;
+    for (char *p = source; *p; line++) {
+        char *next = strchr(p, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        } else {
+            next = p + strlen(p);
         }
-        if (strcmp(op, "lw") == 0 || strcmp(op, "sw") == 0 || strcmp(op, "addi") == 0 || 
-            strcmp(op, "andi") == 0) {
-            char *rd = strtok(NULL, ",");
-            char *rs1 = strtok(NULL, ",");
-            char *imm = strtok(NULL, " \n\r");
-            char rd_buf[REG_LEN + 1];
-            char rs1_buf[REG_LEN + 1];
-            char imm_buf[IMM_LEN + 1];
-            decToBin(atoi(rd + 1), rd_buf, REG_LEN);
-            decToBin(atoi(rs1 + 1), rs1_buf, REG_LEN);
-            decToBin(atoi(imm), imm_buf, IMM_LEN);
-            if (strcmp(op, "lw") == 0) {
-                fprintf(fout, LW_OPCODE"%s%s%s\n", rs1_buf, rd_buf, imm_buf);
-            } else if (strcmp(op, "sw") == 0) {
-                fprintf(fout, SW_OPCODE"%s%s%s\n", rs1_buf, rd_buf, imm_buf);
-            } else if (strcmp(op, "addi") == 0) {
-                fprintf(fout, ADDI_OPCODE"%s%s%s\n", rs1_buf, rd_buf, imm_buf);
-            } else {
-                fprintf(fout, ANDI_OPCODE"%s%s%s\n", rs1_buf, rd_buf, imm_buf);
-            }
-        } else if (strcmp(op, "beqz") == 0) {
-            char *rs1 = strtok(NULL, ",");
-            char *imm = strtok(NULL, " \n\r");
-            char rs1_buf[REG_LEN + 1];
-            char rd_buf[REG_LEN + 1];
-            char imm_buf[IMM_LEN + 1];
-            int offset = 0;
-            for (int i = 0; i < id; i++) {
-                if (strcmp(imm, map[i].label) == 0) {
-                    offset = map[i].address - address;
-                    printf("offset = %d - %d = %d\n", map[i].address, address, offset);
-                }
-            }
-            decToBin(atoi(rs1 + 1), rs1_buf, REG_LEN);
-            decToBin(0, rd_buf, REG_LEN);
-            decToBin(offset - 1, imm_buf, IMM_LEN);
-            fprintf(fout, BEQZ_OPCODE"%s%s%s\n", rs1_buf, rd_buf, imm_buf);
-        } else if (strcmp(op, "add") == 0 || strcmp(op, "sub") == 0 || strcmp(op, "and") == 0) {
-            char *rd = strtok(NULL, ",");
-            char *rs1 = strtok(NULL, ",");
-            char *rs2 = strtok(NULL, " \n\r");
-            char rd_buf[REG_LEN + 1];
-            char rs1_buf[REG_LEN + 1];
-            char rs2_buf[REG_LEN + 1];
-            decToBin(atoi(rd + 1), rd_buf, REG_LEN);
-            decToBin(atoi(rs1 + 1), rs1_buf, REG_LEN);
-            decToBin(atoi(rs2 + 1), rs2_buf, REG_LEN);
-            if (strcmp(op, "add") == 0) {
-                fprintf(fout, ADD_OPCODE"%s%s%s"ADD_FUNC"\n", rs1_buf, rs2_buf, rd_buf);
-            } else if (strcmp(op, "sub") == 0) {
-                fprintf(fout, SUB_OPCODE"%s%s%s"SUB_FUNC"\n", rs1_buf, rs2_buf, rd_buf);
-            } else {
-                fprintf(fout, AND_OPCODE"%s%s%s"AND_FUNC"\n", rs1_buf, rs2_buf, rd_buf);
-            }
-        } else if (strcmp(op, "j") == 0) {
-            char *addr = strtok(NULL, " \n\r");
-            char addr_buf[ADDR_LEN + 1];
-            int offset = 0;
-            for (int i = 0; i < id; i++) {
-                if (strcmp(addr, map[i].label) == 0) {
-                    offset = map[i].address - address;
-                    printf("offset = %d - %d = %d\n", map[i].address, address, offset);
-                    break;
-                }
-            }
-            decToBin(offset - 1, addr_buf, ADDR_LEN);
-            fprintf(fout, J_OPCODE"%s\n", addr_buf);
-        } else if (strcmp(op, "halt") == 0) {
-            fprintf(fout, HALT_OPCODE"00000000000000000000000000\n");
-        } else if (strcmp(op, "noop") == 0) {
-            fprintf(fout, NOOP_OPCODE"00000000000000000000000000\n");
-        } else {  // label
-            printf("error: unknown instruction op %s\n", op);
-            exit(1);
+        assembleLine(p, line);
+        p = next;
+    }
+    for (int i = 0; i < numFixups; i++) {
+        symbol *label = &symbols[fixups[i].symbol];
+        if (label->address == -1) {
+            error(fixups[i].line, "undefined label %.*s", label->length, label->name);
+        } else {
+            patch(fixups[i].address, label->address, fixups[i].bits, fixups[i].line);
         }
-        address++;
+    }
+    if (errors) {
+        printf("%d error%s\n", errors, errors == 1 ? "" : "s");
+        exit(1);
     }
 
-    fclose(fout);
-    fclose(fin);
-
-    fin = fopen("tmp.txt", "r");
-    fout = fopen(argv[2], "w");
+    fout = fopen(argv[2], object ? "wb" : "w");
+    if (fout == NULL) {
+        printf("error: can't open file %s", argv[2]);
+        perror("fopen");
+        exit(1);
+    }
 
-    while (fgets(buf, BUF_SIZE, fin)) {
-        int dec = binToDec(strtok(buf, "\n"));
-        fprintf(fout, "%d\n", dec);
+    if (object) {  // header and the single code segment
+        fwrite(OBJ_MAGIC, 1, 4, fout);
+        putWord(fout, OBJ_VERSION);
+        putWord(fout, 1);
+        putWord(fout, SEG_CODE);
+        putWord(fout, CODE_ADDRESS);
+        putWord(fout, numCode);
+        putWord(fout, 12 + 16);
+    }
+    for (int i = 0; i < numCode; i++) {
+        if (object) {
+            putWord(fout, code[i]);
+        } else {
+            fprintf(fout, "%d\n", (int)code[i]);
+        }
     }
 
     fclose(fout);
-    fclose(fin);
+    free(source);
 
   return 0;
 }
@@ -0,0 +1,86 @@
+#!/bin/bash
+# Runs the sample programs and some large synthetic loops in fast mode
+# (tomasulo -q) and reports simulated cycles per second.
+#
+# usage: ./bench.sh [iterations of the synthetic loops, default 1000000]
+
+set -e
+
+ITERS=${1:-1000000}
+CC=${CC:-cc}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$CC -O2 -o "$DIR/assembler" assembler.c
+$CC -O2 -pthread -o "$DIR/tomasulo" tomasulo.c
+
+# Loop counters are built as base * 2^k + rest so they fit in a 16 bit immediate.
+counter() {
+    local n=$1 k=0
+    while [ $((n >> k)) -gt 32767 ]; do
+        k=$((k + 1))
+    done
+    local base=$((n >> k)) rest
+    echo "addi r1,r1,$base"
+    for ((i = 0; i < k; i++)); do
+        echo "add r1,r1,r1"
+    done
+    rest=$((n - (base << k)))
+    [ $rest -eq 0 ] || echo "addi r1,r1,$rest"
+}
+
+# ALU-bound loop: independent add chains
+alu_loop() {
+    counter "$1"
+    echo "addi r2,r2,1"
+    echo "addi r3,r3,3"
+    echo "loop add r4,r4,r2"
+    echo "add r5,r5,r3"
+    echo "sub r6,r4,r5"
+    echo "and r7,r6,r3"
+    echo "addi r8,r8,1"
+    echo "andi r9,r8,255"
+    echo "addi r1,r1,-1"
+    echo "beqz r1,end"
+    echo "j loop"
+    echo "end halt"
+}
+
+# Memory loop: store/load through a 256 word buffer
+mem_loop() {
+    counter "$1"
+    echo "loop andi r2,r1,255"
+    echo "sw r1,r2,1000"
+    echo "lw r3,r2,1000"
+    echo "add r4,r4,r3"
+    echo "addi r1,r1,-1"
+    echo "beqz r1,end"
+    echo "j loop"
+    echo "end halt"
+}
+
+# Branch loop: a data dependent branch inside the loop
+branch_loop() {
+    counter "$1"
+    echo "loop andi r2,r1,3"
+    echo "beqz r2,skip"
+    echo "addi r3,r3,1"
+    echo "skip addi r1,r1,-1"
+    echo "beqz r1,end"
+    echo "j loop"
+    echo "end halt"
+}
+
+alu_loop "$ITERS" > "$DIR/alu_loop.asm"
+mem_loop "$ITERS" > "$DIR/mem_loop.asm"
+branch_loop "$ITERS" > "$DIR/branch_loop.asm"
+
+printf "%-16s %12s %12s %8s %10s %14s\n" program cycles instrs IPC seconds cycles/sec
+for asm in sample/*.asm "$DIR"/*_loop.asm; do
+    name=$(basename "$asm" .asm)
+    "$DIR/assembler" "$asm" "$DIR/$name.txt" > /dev/null
+    "$DIR/tomasulo" -q "$DIR/$name.txt" > "$DIR/$name.out"
+    get() { grep "^$1=" "$DIR/$name.out" | cut -d= -f2; }
+    printf "%-16s %12s %12s %8s %10s %14s\n" "$name" "$(get Cycles)" "$(get Instructions)" \
+        "$(get IPC)" "$(get Seconds)" "$(get CyclesPerSecond)"
+done
@@ -1,4 +1,4 @@
-import web, json, sys
+import web, json, sys, subprocess
 
 urls = (
     "/", "Home",
@@ -7,53 +7,62 @@ urls = (
 )
 
 
+# usage: python main.py <port> <source file> <machine-code file> [tomasulo options]
 INPUT_PATH = sys.argv[2]
-STATE_PATH = './state.txt'
+PROGRAM_PATH = sys.argv[3]
+OPTIONS = sys.argv[4:]
+SIMULATOR = './tomasulo'
+# the page shows the whole ROB, stations and BTB, the registers and the first 16 words of memory
+PARTS = 'rob rs btb regs mem=0:16'
+
+
+class Simulator:
+    """A `tomasulo -S` process: one command line in, one JSON line out."""
+
+    def __init__(self):
+        self.proc = subprocess.Popen([SIMULATOR, '-S'] + OPTIONS + [PROGRAM_PATH],
+                                     stdin=subprocess.PIPE, stdout=subprocess.PIPE, universal_newlines=True)
+
+    def call(self, command):
+        self.proc.stdin.write(command + '\n')
+        self.proc.stdin.flush()
+        line = self.proc.stdout.readline()
+        if not line.startswith('{'):
+            raise RuntimeError('simulator: ' + (line.strip() or 'exited'))
+        reply = json.loads(line)
+        if not reply['ok']:
+            raise RuntimeError('simulator: ' + reply['error'])
+        return reply
 
 
 class Tomasulo:
     def __init__(self):
-        self.code = []
-        self.instr = []
         with open(INPUT_PATH, 'r') as f:
             self.code = f.readlines()
-        with open(STATE_PATH, 'r') as f:
-            lines = f.readlines()
-            for line in lines:
-                if line.startswith('instr='):
-                    self.instr += [line.split('=')[1].rstrip('\n')]
-        self.cycle = 0
+        self.sim = Simulator()
+        info = self.sim.call('info')
+        self.instr = [str(i) for i in info['instr']]
+        self.units = info['units']
+        self.first = info['first']
+        self.cycle = self.first
 
     def getState(self, step: int):
-        states = {'code': self.code, 'instr': self.instr, 'cycle': self.cycle, 'done': False}
-        with open(STATE_PATH, 'r') as f:
-            total = int(f.readlines()[-1])
-            print(total)
         if step == 1:
-            self.cycle += 1
+            reply = self.sim.call('step 1 ' + PARTS)
         elif step == 0:
-            return states
+            reply = self.sim.call('state ' + PARTS)
         elif step == -1:
-            if self.cycle != 0:
-                self.cycle -= 1
-            else:
-                return states
+            reply = self.sim.call('seek %d %s' % (max(self.cycle - 1, self.first), PARTS))
         else:
-            self.cycle = total
-        states['cycle'] = self.cycle
-        if self.cycle == total:
-            states['done'] = True
-        with open(STATE_PATH, 'r') as f:
-            lines = f.readlines()
-            start = lines.index('Cycle=' + str(self.cycle) + '\n')
-            end = lines.index('Cycle=' + str(self.cycle + 1) + '\n') if self.cycle != total else lines.index(str(total))
-            for line in lines[start+1:end]:
-                entry = line.split('=')
-                states[entry[0]] = entry[1].rstrip('\n')
+            reply = self.sim.call('run ' + PARTS)
+        self.cycle = reply['cycle']
+        states = {'code': self.code, 'instr': self.instr, 'cycle': reply['cycle'],
+                  'done': reply['halted'] or reply['limit'], 'units': self.units}
+        states.update(reply['state'])
         return states
 
     def clear(self):
-        self.cycle = 0
+        self.cycle = self.sim.call('reset')['cycle']
 
 
 tmsl = Tomasulo()
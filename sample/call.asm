@@ -0,0 +1,8 @@
+     addi r1,r0,5      ;call add2 five times
+loop sw r1,r1,0        ;store r1, use r1 as address
+     jal add2          ;run with -p earlyresolve=1 to resolve jal before it commits
+     addi r1,r1,-1     ;counter --
+     bnez r1,loop
+     halt
+add2 addi r2,r2,2      ;r2 = r2+2
+     jr r31            ;return
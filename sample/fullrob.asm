@@ -0,0 +1,19 @@
+     addi r1,r0,10     ;set r1=10, r1 is counter
+     addi r7,r0,3      ;set r7=3
+loop lw r2,r1,100      ;misses with -p l1size=16 and holds the ROB head
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r3,r4,1      ;filler
+     addi r7,r7,2      ;r7 = r7+2
+     addi r1,r1,-1     ;counter --
+     bnez r1,loop      ;the 16th ROB entry, resolved with -p earlyresolve=1 while the ROB is full
+     halt
@@ -0,0 +1,21 @@
+addi r1,r0,10
+addi r2,r0,1
+loop jal mulstep
+addi r1,r1,-1
+bnez r1,loop
+addi r5,r0,1000
+addi r6,r0,7
+div r7,r5,r6
+xor r8,r7,r5
+or r9,r8,r6
+slt r10,r6,r5
+slli r11,r6,3
+srl r12,r11,r10
+ori r13,r0,255
+xori r14,r13,15
+slti r15,r14,300
+sll r16,r10,r6
+div r17,r5,r0
+halt
+mulstep mul r2,r2,r1
+jr r31
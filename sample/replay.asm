@@ -0,0 +1,8 @@
+     addi r2,r0,1      ;set r2=1
+     div r3,r0,r2      ;r3 = 0, slow
+     sw r2,r3,100      ;store address waits for the div
+     beqz r3,skip      ;taken; with -p earlyresolve=1 -p branchexec=3 -p stexec=3
+     lw r4,r0,100      ;wrong path load runs ahead of the store, squashed in the same cycle
+     addi r6,r0,5
+skip addi r7,r4,1      ;r7 = r4+1
+     halt
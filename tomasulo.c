@@ -1,9 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MAXLINELENGTH 1000   // 机器指令的最大长度
-#define MEMSIZE       10000  // 内存的最大容量
+#define MEMSIZE       10000  // 缺省的地址空间大小 (字), memsize = 0 表示完整的 32 位地址空间
+#define MAXPROGRAMSIZE (1 << 30)  // 代码结束地址的上限, 参数扫描时实际由每组参数的 memsize 检查
 #define NUMREGS       32     // 寄存器数量
 
 /*
@@ -14,38 +25,153 @@
 #define SW        43
 #define ADDI      8
 #define ANDI      12
+#define ORI       13
+#define XORI      14
+#define SLTI      10
+#define SLLI      20
+#define SRLI      22
 #define BEQZ      4
+#define BNEZ      5
 #define J         2
+#define JAL       19  // 跳转并把返回地址 PC+1 写入 r31
+#define JR        18  // 跳转到寄存器 rs1 中的地址
 #define HALT      1
 #define NOOP      3
 #define addFunc   32  // ALU 运算的功能码
 #define subFunc   34
 #define andFunc   36
+#define orFunc    37
+#define xorFunc   38
+#define sltFunc   42  // 有符号比较, 小于时结果为 1
+#define sllFunc   4   // 移位量为 rs2 的低 5 位
+#define srlFunc   6   // 逻辑右移
+#define mulFunc   24  // 乘除法在 MUL 保留站和乘除法部件中执行
+#define divFunc   26  // 除数为 0 时结果为 0
+
+#define LINKREG 31  // JAL 写入返回地址的寄存器
 
 #define NOOPINSTRUCTION 0x0c000000;
 
+#define NUMOPCODES 64  // 6 位操作码
+
 /*
- * 执行单元
- */	
-#define LOAD1  0
-#define LOAD2  1
-#define STORE1 2
-#define STORE2 3
-#define INT1   4
-#define INT2   5
+ * 指令格式, 决定发射时如何读取操作数
+ */
+#define FORMAT_R 1  // 寄存器-寄存器运算
+#define FORMAT_I 2  // 立即数, LW/SW, 分支与 JR
+#define FORMAT_J 3  // J, JAL, HALT, NOOP 及无法识别的指令
 
-#define NUMUNITS 6            // 执行单元数量
-char *unitname[NUMUNITS] = {  // 执行单元的名称
-  "LOAD1", "LOAD2", "STORE1", "STORE2", "INT1", "INT2"
+/*
+ * 功能单元类别, 每类的保留站依次命名为 LOAD1, LOAD2, ...
+ * 没有 BRANCH 保留站时, 分支和跳转使用 INT 保留站; 没有 MUL 保留站时, 乘除法也使用 INT 保留站
+ */
+#define UNIT_LOAD   0
+#define UNIT_STORE  1
+#define UNIT_INT    2
+#define UNIT_BRANCH 3
+#define UNIT_MUL    4
+#define NUMCLASSES  5
+char *classname[NUMCLASSES] = {  // 类别名称
+  "LOAD", "STORE", "INT", "BRANCH", "MUL"
 };
 
 /*
- * 不同操作所需要的周期数
+ * 每类保留站的缺省数量
+ */
+#define NUMLOADUNITS   2
+#define NUMSTOREUNITS  2
+#define NUMINTUNITS    2
+#define NUMBRANCHUNITS 0
+#define NUMMULUNITS    0
+
+/*
+ * 执行部件的类别. 保留站中的指令操作数准备好后, 还要占用一个对应类别的执行部件才能开始执行.
+ * 每类执行部件的数量为 0 时不限制, 即每个保留站有自己的执行部件 (缺省).
+ * 执行部件每隔 ii 个周期可以开始一条新的指令, ii 为 0 时要等上一条指令执行完 (不流水).
+ */
+#define FU_ALU       0  // 整数运算, HALT, NOOP
+#define FU_BRANCH    1  // 分支和跳转
+#define FU_AGU       2  // LW, SW 的地址计算和访存
+#define FU_MUL       3  // 乘法
+#define FU_DIV       4  // 除法
+#define NUMFUCLASSES 5
+char *fuName[NUMFUCLASSES] = {"ALU", "BRU", "AGU", "MUL", "DIV"};
+
+/*
+ * 不同操作所需要的周期数 (缺省值)
  */
 #define BRANCHEXEC 3	// 分支操作
 #define LDEXEC     2	// Load
 #define STEXEC     2	// Store
 #define INTEXEC    1	// 整数运算
+#define MULEXEC    4	// 乘法
+#define DIVEXEC    12	// 除法
+
+/*
+ * 每周期最多发射和提交的指令数 (缺省值)
+ */
+#define ISSUEWIDTH  1
+#define COMMITWIDTH 1
+
+/*
+ * Load 遇到地址未知的 store 时的处理 (缺省值):
+ * 1 表示推测执行, 在 store 算出地址时检查冲突并重新执行 load; 0 表示等待
+ */
+#define MEMSPEC 1
+
+/*
+ * cache 的编号. 容量和块大小以字为单位, l1size 为 0 时不模拟数据 cache,
+ * LW/SW 的执行周期数固定为 ldexec/stexec; l2size 为 0 时 L1 缺失直接访问内存.
+ * 指令 cache (L1I) 只在有取指队列时模拟, 缺失时和 L1 一样从 L2 或内存取块.
+ */
+#define L1        0
+#define L2        1
+#define L1I       2
+#define NUMCACHES 3
+
+/*
+ * 数据 cache 的缺省参数
+ */
+#define L1SIZE     0   // L1 容量, 0 表示不模拟 cache
+#define L1WAYS     2   // L1 每组的块数
+#define L1LINE     4   // L1 块大小
+#define L1LAT      1   // L1 命中的周期数
+#define L2SIZE     0   // L2 容量, 0 表示没有 L2
+#define L2WAYS     8
+#define L2LINE     8
+#define L2LAT      8   // L1 缺失, L2 命中时增加的周期数
+#define MEMLAT     50  // 访问内存增加的周期数
+#define WRITEBACK  1   // L1 写策略: 1 为写回, 0 为写直达
+#define WRITEALLOC 1   // L1 写缺失: 1 为按写分配, 0 为不分配
+#define MSHRS      4   // L1 同时未完成的缺失数
+#define L1ISIZE    0   // 指令 cache 容量, 0 表示取指总是命中
+#define L1IWAYS    2
+#define L1ILINE    4
+
+/*
+ * 物理寄存器数 (缺省值). 0 表示结果保存在 ROB 中, 提交时写入寄存器;
+ * 否则每条写寄存器的指令发射时从空闲表中分配一个物理寄存器, 结果写回物理寄存器,
+ * 提交时只修改已提交的映射并释放原来的物理寄存器, 不再搬移数据.
+ */
+#define PHYSREGS 0
+
+/*
+ * 取指 (缺省值). 取指队列为 0 项时没有单独的取指阶段, 发射时直接从内存读指令并预测;
+ * 否则取指阶段每周期沿预测的路径最多取 fetchwidth 条指令放入队列, 发射从队列中读取.
+ */
+#define FETCHQUEUE 0
+#define FETCHWIDTH 2
+
+/*
+ * 操作类别, 用于查找执行周期数
+ */
+#define LAT_BRANCH 0
+#define LAT_LOAD   1
+#define LAT_STORE  2
+#define LAT_INT    3
+#define LAT_MUL    4
+#define LAT_DIV    5
+#define NUMLATENCY 6
 
 /*
  * 指令状态
@@ -58,8 +184,9 @@ char *statename[4] = {   // 状态名称
   "ISSUING", "EXECUTING", "WRITINGRESULT", "COMMTITTING"
 };
 
-#define RBSIZE	16  // ROB 有 16 个单元
-#define BTBSIZE	8   // 分支预测缓冲栈有 8 个单元
+#define RBSIZE	16  // ROB 缺省有 16 个单元
+#define BTBSIZE	8   // 分支预测缓冲栈缺省有 8 个单元
+#define BTBWAYS 8   // BTB 缺省为 8 路组相联, 即只有一组
 
 /*
  * 2 bit 分支预测状态
@@ -72,12 +199,242 @@ char *predname[4] = {   // 状态名称
   "STRONGNOT", "WEAKTAKEN", "WEAKNOT", "STRONGTAKEN"
 };
 
+/*
+ * 分支预测器
+ */
+#define PRED_BIMODAL    0  // BTB 中的 2 bit 计数器
+#define PRED_GSHARE     1  // 全局历史与 PC 异或索引的计数器表
+#define PRED_TOURNAMENT 2  // 按 PC 选择 bimodal 或 gshare
+#define PRED_TAGE       3  // 基础表 + 按几何长度历史带标签的表
+#define NUMPREDICTORS   4
+char *predictorName[NUMPREDICTORS + 1] = {
+  "bimodal", "gshare", "tournament", "tage", NULL
+};
+
+/*
+ * 分支在哪里确定结果 (缺省值): 0 表示提交时, 预测错误时清空整个流水线;
+ * 1 表示执行完成时, 只清除更年轻的指令
+ */
+#define EARLYRESOLVE 0
+
+/*
+ * J 指令在哪里跳转 (缺省值): 0 表示在整数保留站中计算目标, 提交时清空流水线跳转;
+ * 1 表示发射时直接算出目标并修改 PC, 不占用保留站
+ */
+#define JUMPATISSUE 0
+
+/*
+ * 公共数据总线的条数 (缺省值), 0 表示不限制每周期写回的结果数
+ */
+#define CDBS 0
+
+#define PREDICTOR PRED_BIMODAL  // 缺省的预测器
+#define PHTBITS   10            // 预测器每张表 2^PHTBITS 项
+#define HISTBITS  10            // gshare 和 tournament 使用的全局历史长度
+
+#define NUMTAGE 4  // TAGE 带标签的表数
+int tageHistLen[NUMTAGE] = {4, 8, 16, 32};  // 每张表使用的历史长度
+
+/*
+ * 每个周期按发射阶段的情况归入一类, 各类周期数之和等于总周期数:
+ * 发射了指令; 发射的指令后来被清除或本周期清空了流水线; HALT 已发射, 等待它提交;
+ * 其余是没有发射的原因. 所需类别的保留站都被占用时, 其中有指令还在等待操作数
+ * 记为等待操作数, 否则记为该类保留站已满; 有空闲的保留站但没有空闲的物理寄存器时记为后者.
+ */
+#define CYCLE_ISSUE    0  // 发射了至少一条指令
+#define CYCLE_FLUSH    1  // 清除错误路径的指令
+#define CYCLE_HALT     2  // 等待 HALT 提交
+#define CYCLE_ROBFULL  3  // ROB 已满
+#define CYCLE_FRONTEND 4  // 没有可以发射的指令
+#define CYCLE_OPERAND  5  // 保留站被等待操作数的指令占满
+#define CYCLE_REGFULL  6  // 没有空闲的物理寄存器
+#define CYCLE_RSFULL   7  // 加上类别编号: 该类保留站已满
+#define NUMCAUSES      (CYCLE_RSFULL + NUMCLASSES)
+
+/*
+ * simulate 的返回值
+ */
+#define SIM_HALT  0  // 执行了 HALT 指令
+#define SIM_LIMIT 1  // 达到周期数上限
+#define SIM_FAULT 2  // LW/SW 的地址超出地址空间
+
 /*
  * 分支跳转结果
  */
 #define NOTTAKEN 0
 #define TAKEN    1
 
+/*
+ * 状态输出格式
+ */
+#define TRACE_TEXT   0  // 文本格式, 每个周期输出全部 KEY=value
+#define TRACE_BINARY 1  // 二进制格式, 关键帧 + 逐周期增量
+#define TRACE_NONE   2  // 不输出逐周期状态, 停机时只输出结果和统计
+
+/*
+ * 二进制 trace 格式:
+ *   文件头: "TMTR", 版本号, 关键帧间隔, 各部件数量, 执行单元名称, 程序指令
+ *   关键帧 'K': 周期数, 全部字段
+ *   增量帧 'D': 周期数, 变化字段个数, 若干 (字段序号差, 新值)
+ *   结束帧 'E': 总周期数
+ * 除 magic 和记录类型外, 所有整数都使用 LEB128 变长编码, 有符号数先做 zigzag 编码.
+ * 字段按 PC, ROB, 保留站, BTB, 寄存器, 内存的顺序展开, 读取方法见 tracereader.py
+ */
+#define TRACE_MAGIC    "TMTR"
+#define TRACE_VERSION  1
+#define TRACE_KEYFRAME 'K'
+#define TRACE_DELTA    'D'
+#define TRACE_END      'E'
+#define KEYFRAMEINTERVAL 64  // 缺省的关键帧间隔
+
+/*
+ * 内存按页分配: 每页 PAGEWORDS 个字 (4 KiB), 第一次写入时才分配, 没有分配的页读出 0.
+ * 32 位的字地址分为目录号, 页表号和页内偏移, 二级页表也在第一次用到时分配.
+ */
+#define PAGEBITS   10
+#define PAGEWORDS  (1 << PAGEBITS)
+#define TABLEBITS  11
+#define TABLESIZE  (1 << TABLEBITS)
+#define DIRSIZE    (1 << (32 - PAGEBITS - TABLEBITS))
+
+/*
+ * 二进制目标文件格式 (assembler -b): "TMOB", 版本号(4 字节), 段数(4 字节),
+ * 然后是段表, 每段为 类型(4 字节), 装入地址(4 字节), 字数(4 字节), 内容在文件中的偏移量(4 字节),
+ * 最后是各段的内容, 每个字 4 字节. 代码段按地址连续存放并在装入时解码, 结束地址就是程序大小;
+ * 数据段只写入内存, 可以在地址空间的任何位置. 程序总是从地址 16 开始执行. 所有整数均为小端序.
+ */
+#define OBJ_MAGIC   "TMOB"
+#define OBJ_VERSION 1
+#define SEG_CODE    1
+#define SEG_DATA    2
+
+/*
+ * 索引文件格式: "TMIX", 版本号(4 字节), 记录数 n(4 字节), 然后是 n + 1 个 8 字节偏移量.
+ * 第 i 个偏移量是第 i 条周期记录在 trace 中的起始位置, 最后一个是结束记录的位置.
+ * 周期记录按周期号依次排列, 停机时的状态会再输出一次, 所以 n = 总周期数 + 2.
+ * 所有整数均为小端序.
+ */
+#define INDEX_MAGIC   "TMIX"
+#define INDEX_VERSION 1
+
+/*
+ * 检查点文件格式: "TMCK", 版本号(4 字节), 机器状态的大小(8 字节), 程序大小(4 字节),
+ * 参数长度(4 字节) 和参数, 然后是若干条检查点记录: 'C', 周期数(4 字节), 数据长度(8 字节), 数据.
+ * 数据是机器状态的内存块, 写过的页数(4 字节), 再是每一页的页号(4 字节) 和内容.
+ * 内存块和每页的内容都按 4 字节的字压缩, 重复 (连续 0 字的个数, 非 0 字的个数, 这些非 0 字).
+ * 状态中的指针在恢复时按参数重新设置. 所有整数均为小端序.
+ */
+#define CKPT_MAGIC   "TMCK"
+#define CKPT_VERSION 2
+#define CKPT_RECORD  'C'
+#define CKPTINTERVAL 100000  // 缺省的检查点间隔 (周期)
+
+/*
+ * 交互模式 (-S 或 -U): 每行一条命令, 每条命令回复一行 JSON, 命令见 serveCommand.
+ * 运行时每隔 SNAPINTERVAL 个周期在内存中保存一份机器状态, 向回跳转时从之前最近的一份重新运行.
+ * 快照最多 MAXSNAPS 份, 满了以后隔一份丢弃一份并把间隔加倍, 所以内存占用不随运行长度增长.
+ */
+#define SNAPINTERVAL 10000  // 缺省的内存快照间隔 (周期)
+#define MAXSNAPS     64     // 内存快照数上限
+#define PART_ROB   1        // 请求的状态部分
+#define PART_RS    2
+#define PART_BTB   4
+#define PART_REGS  8
+#define PART_MEM   16
+#define PART_STATS 32
+#define PART_PAGES 64
+
+#define RBFIELDS  9  // 每个 ROB 项展开的字段数
+#define RSFIELDS  8  // 每个保留站展开的字段数
+#define BTFIELDS  4  // 每个 BTB 项展开的字段数
+#define REGFIELDS 3  // 每个寄存器展开的字段数
+
+/*
+ * 操作码表项
+ */
+typedef struct _opInfo {
+  int format;     // 指令格式
+  int unitClass;  // 功能单元类别
+  int latClass;   // 操作类别, 决定执行周期数
+  int fuClass;    // 执行部件类别
+} opInfo;
+
+/*
+ * 机器参数. 缺省值为上面的宏, 可以由配置文件 (-c) 和命令行 (-p key=value) 修改.
+ * 所有数组在创建机器状态时一次性分配, 之后不再改变大小.
+ */
+typedef struct _machineConfig {
+  int rbSize;                // ROB 项数
+  int btbSize;               // BTB 项数
+  int btbWays;               // BTB 每组的项数, btbSize 必须是它的倍数, 大于 btbSize 时为全相联
+  int memSize;               // 地址空间大小 (字), LW/SW 的地址超出时报错, 0 表示不限制
+  int units[NUMCLASSES];     // 每类保留站的数量
+  int latency[NUMLATENCY];   // 每类操作的执行周期数
+  int issueWidth;            // 每周期最多发射的指令数
+  int commitWidth;           // 每周期最多提交的指令数
+  int memSpec;               // load 是否越过地址未知的 store 推测执行
+  int earlyResolve;          // 分支是否在执行完成时确定结果
+  int jumpAtIssue;           // J 是否在发射时跳转
+  int cdbs;                  // 公共数据总线条数, 0 表示不限制
+  int predictor;             // 分支预测器, PRED_*
+  int phtBits;               // 预测器每张表的项数为 2^phtBits
+  int histBits;              // 全局历史长度
+  int cacheSize[NUMCACHES];  // 每级 cache 的容量 (字), L1 为 0 时不模拟 cache
+  int cacheWays[NUMCACHES];  // 每级 cache 每组的块数, 大于块数时为全相联
+  int lineSize[NUMCACHES];   // 每级 cache 的块大小 (字)
+  int cacheLat[NUMCACHES];   // 访问每级 cache 的周期数
+  int memLat;                // 访问内存的周期数
+  int writeBack;             // L1 为写回 (1) 或写直达 (0), L2 总是写回
+  int writeAlloc;            // L1 写缺失时是否分配块, L2 总是分配
+  int mshrs;                 // L1 的 MSHR 数, 即同时未完成的缺失数
+  int fetchQueue;            // 取指队列的项数, 0 表示没有单独的取指阶段
+  int fetchWidth;            // 每周期最多取的指令数
+  int physRegs;              // 物理寄存器数, 0 表示不使用物理寄存器
+  int maxCycles;             // 运行周期数上限, 0 表示不限制
+  int fus[NUMFUCLASSES];     // 每类执行部件的数量, 0 表示不限制
+  int fuII[NUMFUCLASSES];    // 每类执行部件开始相邻两条指令的间隔, 0 表示不流水
+  int numUnits;              // 保留站总数
+  int numFUs;                // 执行部件总数
+  int fuBase[NUMFUCLASSES];  // 每类执行部件在 fuFree 中的起始位置
+  char **unitname;           // 每个保留站的名称
+  int *unitclass;            // 每个保留站所属的类别
+} machineConfig;
+
+/*
+ * 解码后的指令. 程序装入时每条指令只解码一次,
+ * 发射, 执行和提交都只读取这里的字段.
+ */
+typedef struct _decodedInstr {
+  int instr;      // 原始指令
+  int op;         // 操作码
+  int func;       // R 型指令的功能码
+  int rs1;        // 第一个源寄存器
+  int rs2;        // 第二个源寄存器, SW 为要写入内存的寄存器
+  int rd;         // 目的寄存器, 不写寄存器时为 -1
+  int imm;        // 符号扩展后的立即数
+  int format;     // 指令格式
+  int unitClass;  // 功能单元类别
+  int latClass;   // 操作类别, 执行周期数为 config->latency[latClass]
+  int fuClass;    // 执行部件类别
+} decodedInstr;
+
+/*
+ * 装入的程序. 只读, 可以由多个机器状态共享
+ */
+typedef struct _segment {
+  unsigned int address;  // 装入地址
+  int count;             // 字数
+  int *words;            // 内容
+} segment;
+
+typedef struct _program {
+  int size;               // 程序结束地址, 即需要输出的内存大小
+  int *words;             // 内存 [0, size) 的初始内容
+  decodedInstr *decoded;  // 每个地址的解码结果
+  int numData;            // 目标文件中的数据段, 装入时写入内存
+  segment *data;
+} program;
+
 /*
  * 保留站的数据结构
  */
@@ -103,8 +460,23 @@ typedef struct _reorderEntry {
   int valid;		     // 表明结果是否有效的标志位
   int result;		     // 在提交之前临时存放结果
   int storeAddress;  // store 指令的内存地址
-  int branchCmp;     // beqz 指令的比较结果
-  int branchPC;      // beqz 指令的 PC
+  int branchCmp;     // 条件分支的比较结果, 1 表示跳转
+  int branchPC;      // 条件分支指令的 PC
+  decodedInstr dec;  // 解码后的指令
+  int pc;                 // 指令的 PC, 重新执行时从这里取指
+  int predPC;             // 分支和跳转发射时预测的下一条指令的 PC
+  unsigned long long predHist;  // 分支和跳转发射时的全局历史
+  int issueCycle;         // 发射的周期
+  long long issueMark;    // 发射时记为 CYCLE_ISSUE 的周期数 (含本周期), 清除之后的指令时据此改记
+  long long haltMark;     // 发射时记为 CYCLE_HALT 的周期数
+  int resolved;           // 分支已在执行完成时确定结果
+  int mispredicted;       // 确定结果时发现预测错误
+  int resolveCycle;       // 确定结果的周期
+  long long seq;          // 发射序号, 越大越新
+  int loadAddress;        // load 指令的内存地址
+  long long loadSource;   // load 的数据来源: 转发数据的 store 的序号, 读内存时为 -1
+  int physDest;           // 物理寄存器模式下分配的物理寄存器
+  int oldPhys;            // 目的寄存器原来映射的物理寄存器, 提交时释放
 } reorderEntry;
 
 /*
@@ -123,23 +495,263 @@ typedef struct _btbEntry {
   int branchPC;      // 分支指令的 PC 值
   int branchTarget;  // when predict taken, update PC with target
   int branchPred;    // 预测: 2 bit 分支历史
+  long long lastUse; // 最近一次访问的时间, 用于 LRU 替换
 } btbEntry;
 
+/*
+ * cache 块. 只记录标签, 数据仍在 memory 中, cache 只决定访存的周期数
+ */
+typedef struct _cacheLine {
+  int valid;          // 有效位
+  int dirty;          // 写回策略下被写过的块
+  unsigned int block; // 块地址, 即字地址 / 块大小
+  long long lastUse;  // 最近一次访问的时间, 用于 LRU 替换
+} cacheLine;
+
+/*
+ * 取指队列项: 取到的指令和取指时的预测
+ */
+typedef struct _fetchEntry {
+  decodedInstr dec;             // 解码后的指令
+  int pc;                       // 指令的 PC
+  int predPC;                   // 预测的下一条指令的 PC
+  unsigned long long predHist;  // 取指时的全局历史
+} fetchEntry;
+
+/*
+ * L1 的缺失状态寄存器: 正在从下一级取的块和取回的周期
+ */
+typedef struct _mshrEntry {
+  unsigned int block;  // 块地址
+  int ready;           // 块取回的周期, 不大于当前周期时该项空闲
+} mshrEntry;
+
+/*
+ * TAGE 带标签的表项
+ */
+typedef struct _tageEntry {
+  unsigned char tag;
+  signed char ctr;       // 3 bit 有符号计数器, >= 0 预测跳转
+  unsigned char useful;  // 2 bit 有用计数器
+} tageEntry;
+
+/*
+ * 运行统计
+ */
+typedef struct _simStats {
+  long long instructions;  // 提交的指令数
+  long long branches;      // 提交的 BEQZ/BNEZ 指令数
+  long long mispredicts;   // 预测错误的 BEQZ/BNEZ 指令数
+  long long jumps;         // 提交的 J/JAL/JR 指令数
+  long long flushes;       // 清空流水线的次数
+  long long forwards;      // 从 store 转发数据的 load 数
+  long long replays;       // 因访存冲突重新执行的次数
+  long long loadWaits;     // load 等待 store 地址的周期数
+  long long btbHits;       // 取条件分支和 JR 时 BTB 命中的次数
+  long long btbMisses;     // 取条件分支和 JR 时 BTB 缺失的次数
+  long long btbEvictions;  // BTB 缺失时替换有效项的次数
+  long long penaltyCycles; // 预测错误的分支和跳转从发射到修改 PC 的周期数之和
+  long long cdbStalls;     // 结果因为没有空闲的公共数据总线而推迟写回的次数
+  long long skippedCycles; // 只有指令在倒计时而被直接跳过的周期数
+  long long cacheHits[NUMCACHES];    // 每级 cache 的命中次数
+  long long cacheMisses[NUMCACHES];  // 每级 cache 的缺失次数
+  long long mshrMerges;    // L1 缺失时块已经在取, 合并到已有 MSHR 的次数
+  long long mshrStalls;    // LW/SW 因为没有空闲的 MSHR 而不能开始执行的周期数
+  long long writebacks;    // 替换脏块写到下一级的次数
+  long long writeThroughs; // store 提交时直接写到下一级的次数
+  long long memAccesses;   // 开始执行的 LW/SW 数
+  long long memCycles;     // 这些 LW/SW 的执行周期数之和
+  long long fetchBubbles;  // ROB 有空位, 但取指队列为空而不能发射的周期数
+  long long fetchQueueFull; // 取指队列已满而不能取指的周期数
+  long long icacheStalls;  // 等待指令 cache 缺失而不能取指的周期数
+  long long cycleCauses[NUMCAUSES];  // 每类周期的周期数, 见 CYCLE_*
+  long long fuStalls;      // 操作数已准备好, 但没有空闲的执行部件而不能开始执行的次数
+} simStats;
+
+/*
+ * 内存页和页表. 页表不在机器状态的内存块中, 复制和保存机器状态时只处理写过的页.
+ */
+typedef struct _memPage {
+  unsigned int number;   // 页号
+  int data[PAGEWORDS];
+} memPage;
+
+typedef struct _pageTable {
+  memPage **dir[DIRSIZE];  // 目录, 每项是 TABLESIZE 项的二级页表
+  memPage **dirty;         // 写过的页 (装入程序或 SW 提交), 按第一次写入的顺序; 只有这些页被分配
+  int numDirty;
+  int capacity;
+} pageTable;
+
 /*
  * 虚拟机状态的数据结构
  */
 typedef struct _machineState {
   int pc;		                          // PC
   int cycles;                         // 已经过的周期数
-  resStation reservation[NUMUNITS];		// 保留站
-  reorderEntry	reorderBuf[RBSIZE];		// ROB
+  machineConfig *config;              // 机器参数
+  resStation *reservation;		        // 保留站, config->numUnits 项
+  reorderEntry	*reorderBuf;		      // ROB, config->rbSize 项
   regResultEntry regResult[NUMREGS];  // 寄存器状态
-  btbEntry	btBuf[BTBSIZE];           // 分支预测缓冲栈
-  int memory[MEMSIZE];                // 内存
+  btbEntry	*btBuf;                   // 分支预测缓冲栈, config->btbSize 项
+  pageTable *memory;                  // 内存, 按页分配, 不在机器状态的内存块中
   int regFile[NUMREGS];               // 寄存器
+  decodedInstr *decoded;              // 装入时解码的指令, 按地址索引, 与其他机器状态共享
+  simStats stats;                     // 运行统计
+  long long seqNum;                   // 下一条发射的指令的序号
+  unsigned long long ghr;             // 全局分支历史, 发射时按预测更新, 预测错误时恢复
+  long long btbClock;                 // BTB 访问计数, 作为 LRU 的时间
+  unsigned char *bimodal;             // 按 PC 索引的 2 bit 计数器, 2^phtBits 项
+  unsigned char *pht;                 // 按 PC 和历史索引的 2 bit 计数器, 2^phtBits 项
+  unsigned char *choice;              // tournament 的选择计数器, 2^phtBits 项
+  tageEntry *tage;                    // TAGE 带标签的表, NUMTAGE * 2^phtBits 项
+  cacheLine *cache[NUMCACHES];        // 每级 cache 的块, cacheSize / lineSize 项
+  mshrEntry *mshr;                    // L1 的 MSHR, config->mshrs 项
+  long long cacheClock;               // cache 访问计数, 作为 LRU 的时间
+  fetchEntry *fetchQueue;             // 取指队列, config->fetchQueue 项的循环队列
+  int fqHead;                         // 取指队列的队首
+  int fqCount;                        // 取指队列中的指令数
+  int fetchReady;                     // 指令 cache 缺失时, 可以继续取指的周期
+  int haltsInFlight;                  // ROB 中的 HALT 数
+  long long *unitBusy;                // 每个保留站被占用的周期数, config->numUnits 项
+  long long *robHist;                 // ROB 中有 k 条指令的周期数, config->rbSize + 1 项
+  int *fuFree;                        // 每个执行部件可以开始下一条指令的周期, config->numFUs 项
+  regResultEntry *checkpoints;        // 分支发射时的寄存器状态, 每个 ROB 项 NUMREGS 项
+  int *consumerHead;                  // 每个 ROB 项的等待者链表, config->rbSize 项
+  int *consumerNext;                  // 等待者链表的下一个, 按 保留站 * 2 + 操作数 索引
+  int renameMap[NUMREGS];             // 物理寄存器模式: 每个寄存器最新的映射
+  int archMap[NUMREGS];               // 物理寄存器模式: 每个寄存器已提交的映射
+  int *physFile;                      // 物理寄存器, config->physRegs 项
+  int *physReady;                     // 物理寄存器的值是否已经写回
+  int *freeList;                      // 空闲的物理寄存器, 栈
+  int freeCount;                      // 空闲的物理寄存器数
+  int *physMark;                      // 重建空闲表时的标记
+  int headRB;                         // ROB 的队首, 空时为 -1, 只在周期之间有效
+  int tailRB;                         // ROB 的队尾
+  int halted;                         // 已经执行了 HALT, 或发生了访存错误
+  int fault;                          // 访存错误: 提交的 LW/SW 的地址超出地址空间, 机器停在这条指令
+  unsigned int faultAddress;          // 出错的地址
+  int faultPC;                        // 出错的指令的 PC
+  size_t blockSize;                   // 机器状态和所有表占用的内存大小
 } machineState;
 
+/*
+ * 状态输出的数据结构
+ */
+typedef struct _traceWriter {
+  FILE *fp;        // 输出文件
+  int format;      // TRACE_TEXT 或 TRACE_BINARY
+  int interval;    // 关键帧间隔
+  int numFields;   // 每个周期展开的字段数
+  int *fields;     // 当前周期的字段
+  int *prev;       // 上一周期的字段, 用于计算增量
+  int hasPrev;     // prev 是否有效
+  FILE *indexFp;   // 索引文件, 为 NULL 时不写索引
+  int numRecords;  // 已写入的周期记录数
+  FILE *ckptFp;     // 检查点文件, 为 NULL 时不写检查点
+  int ckptInterval; // 检查点间隔
+  int ckptNext;     // 下一个检查点的周期
+} traceWriter;
+
+/*
+ * 查找地址所在的页, 没有分配时返回 NULL
+ */
+memPage *findPage(pageTable *mem, unsigned int address) {
+  memPage **table = mem->dir[address >> (PAGEBITS + TABLEBITS)];
+  return (table == NULL) ? NULL : table[(address >> PAGEBITS) & (TABLESIZE - 1)];
+}
+
+/*
+ * 返回地址所在的页, 没有时分配一页并记入写过的页
+ */
+memPage *touchPage(pageTable *mem, unsigned int address) {
+  memPage **table = mem->dir[address >> (PAGEBITS + TABLEBITS)];
+  if (table == NULL) {
+    table = (memPage **) calloc(TABLESIZE, sizeof(memPage *));
+    if (table == NULL) {
+      printf("error: out of memory\n");
+      exit(1);
+    }
+    mem->dir[address >> (PAGEBITS + TABLEBITS)] = table;
+  }
+  memPage *page = table[(address >> PAGEBITS) & (TABLESIZE - 1)];
+  if (page == NULL) {
+    if (mem->numDirty == mem->capacity) {
+      mem->capacity = mem->capacity ? 2 * mem->capacity : 64;
+      mem->dirty = (memPage **) realloc(mem->dirty, mem->capacity * sizeof(memPage *));
+    }
+    page = (memPage *) calloc(1, sizeof(memPage));
+    if (page == NULL || mem->dirty == NULL) {
+      printf("error: out of memory\n");
+      exit(1);
+    }
+    page->number = address >> PAGEBITS;
+    table[(address >> PAGEBITS) & (TABLESIZE - 1)] = page;
+    mem->dirty[mem->numDirty++] = page;
+  }
+  return page;
+}
+
+int readWord(machineState *statePtr, unsigned int address) {
+  memPage *page = findPage(statePtr->memory, address);
+  return (page == NULL) ? 0 : page->data[address & (PAGEWORDS - 1)];
+}
+
+void writeWord(machineState *statePtr, unsigned int address, int value) {
+  touchPage(statePtr->memory, address)->data[address & (PAGEWORDS - 1)] = value;
+}
+
+/*
+ * 释放所有的页, 内存回到全 0
+ */
+void clearPages(pageTable *mem) {
+  for (int i = 0; i < mem->numDirty; i++) {
+    free(mem->dirty[i]);
+  }
+  for (int i = 0; i < DIRSIZE; i++) {
+    free(mem->dir[i]);
+    mem->dir[i] = NULL;
+  }
+  mem->numDirty = 0;
+}
+
+/*
+ * 让 dst 的内容与 src 相同
+ */
+void copyPages(pageTable *dst, pageTable *src) {
+  clearPages(dst);
+  for (int i = 0; i < src->numDirty; i++) {
+    memPage *page = touchPage(dst, src->dirty[i]->number << PAGEBITS);
+    memcpy(page->data, src->dirty[i]->data, sizeof(page->data));
+  }
+}
+
+/*
+ * LW/SW 的地址是否超出地址空间. 错误路径上的访存不报错, 所以只在提交时检查.
+ */
+int memFault(machineState *statePtr, reorderEntry *RBPtr) {
+  unsigned int memSize = statePtr->config->memSize;
+  if (RBPtr->dec.op == LW) {
+    return memSize > 0 && (unsigned int) RBPtr->loadAddress >= memSize;
+  }
+  if (RBPtr->dec.op == SW) {
+    return memSize > 0 && (unsigned int) RBPtr->storeAddress >= memSize;
+  }
+  return 0;
+}
+
+/*
+ * 寄存器 r 已提交的值
+ */
+int regValue(machineState *statePtr, int r) {
+  if (statePtr->config->physRegs > 0) {
+    return statePtr->physFile[statePtr->archMap[r]];
+  }
+  return statePtr->regFile[r];
+}
+
 void printState(machineState *statePtr, int memorySize) {
+	machineConfig *cfg = statePtr->config;
 	int i;
 	
 	printf("Cycles: %d\n", statePtr->cycles);
@@ -147,9 +759,9 @@ void printState(machineState *statePtr, int memorySize) {
 	printf("\t pc = %d\n", statePtr->pc);
 	
 	printf("\t Reservation stations:\n");
-	for (i = 0; i < NUMUNITS; i++) {
+	for (i = 0; i < cfg->numUnits; i++) {
 		if (statePtr->reservation[i].busy == 1) {
-			printf("\t \t Reservation station %s: ", unitname[i]);
+			printf("\t \t Reservation station %s: ", cfg->unitname[i]);
 			if (statePtr->reservation[i].Qj == -1) {
         printf("Vj = %d ", statePtr->reservation[i].Vj);
       } else {
@@ -167,12 +779,12 @@ void printState(machineState *statePtr, int memorySize) {
 	}
 	
 	printf("\t Reorder buffers:\n");
-	for (i = 0; i < RBSIZE; i++) {
+	for (i = 0; i < cfg->rbSize; i++) {
 		if (statePtr->reorderBuf[i].busy == 1) {
 			printf("\t \t Reorder buffer %d: ",i);
 			printf("instr %d  executionUnit '%s'  state %s  valid %d  result %d storeAddress %d\n",
 				statePtr->reorderBuf[i].instr,
-				unitname[statePtr->reorderBuf[i].execUnit],
+				(statePtr->reorderBuf[i].execUnit == -1) ? "none" : cfg->unitname[statePtr->reorderBuf[i].execUnit],
 				statename[statePtr->reorderBuf[i].instrStatus], 
 				statePtr->reorderBuf[i].valid, statePtr->reorderBuf[i].result,
 				statePtr->reorderBuf[i].storeAddress); 
@@ -192,7 +804,7 @@ void printState(machineState *statePtr, int memorySize) {
 	 * [TODO]如果你实现了动态分支预测, 将这里的注释取消
 	 */
   printf("\t Branch target buffer:\n");
-  for (i=0; i<BTBSIZE; i++){
+  for (i=0; i<cfg->btbSize; i++){
     if (statePtr->btBuf[i].valid){
       printf("\t \t Entry %d: PC=%d, Target=%d, Pred=%d\n",
       i, statePtr->btBuf[i].branchPC, statePtr->btBuf[i].branchTarget,
@@ -202,12 +814,12 @@ void printState(machineState *statePtr, int memorySize) {
 	 
 	printf("\t Memory:\n");
 	for (i = 0; i < memorySize; i++) {
-		printf("\t \t memory[%-2d] = %d\n", i, statePtr->memory[i]);
+		printf("\t \t memory[%-2d] = %d\n", i, readWord(statePtr, i));
 	}
 	
 	printf("\t Registers:\n");
 	for (i = 0; i < NUMREGS; i++) {
-		printf("\t \t regFile[%-2d] = %d\n", i, statePtr->regFile[i]);
+		printf("\t \t regFile[%-2d] = %d\n", i, regValue(statePtr, i));
 	}
 }
 
@@ -221,7 +833,7 @@ int convertNum16(int num) {
 
 int convertNum26(int num) {
   /* convert a 26 bit number into a 32-bit or 64-bit number */
-  if (num & 0x200000) {
+  if (num & 0x2000000) {
     num -= 67108864;
   }
   return(num);
@@ -229,98 +841,152 @@ int convertNum26(int num) {
 
 /*
  * 这里对指令进行解码，转换成程序可以识别的格式，需要根据指令格式来进行。
- * 可以考虑使用高级语言中的位和逻辑运算
+ * 每个字段只需要一次移位和一次掩码
  */
 /*
  * 返回指令的第一个寄存器RS1
  */
 int field0(int instruction) {
-  int res = 0;
-  for (int i = 25; 21 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
-  }
-  res += (instruction >> 21) & 0x1;
-  return res;
+  return (instruction >> 21) & 0x1f;
 }
 
 /*
  * 返回指令的第二个寄存器，RS2或者Rd
  */
 int field1(int instruction) {
-  int res = 0;
-  for (int i = 20; 16 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
-  }
-  res += (instruction >> 16) & 0x1;
-  return res;
+  return (instruction >> 16) & 0x1f;
 }
 
 /*
  * 返回指令的第三个寄存器，Rd
  */
 int field2(int instruction) {
-  int res = 0;
-  for (int i = 15; 11 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
-  }
-  res += (instruction >> 11) & 0x1;
-  return res;
+  return (instruction >> 11) & 0x1f;
 }
 
 /*
  * 返回I型指令的立即数部分
  */
 int immediate(int instruction) {
-  int res = 0;
-  for (int i = 15; 0 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
-  }
-  res += instruction & 0x1;
-  return convertNum16(res);
+  return convertNum16(instruction & 0xffff);
 }
 
 /*
  * 返回J型指令的跳转地址
  */
 int jumpAddr(int instruction) {
-  int res = 0;
-  for (int i = 25; 0 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
-  }
-  res += instruction & 0x1;
-  return convertNum26(res);
+  return convertNum26(instruction & 0x3ffffff);
 }
 
 /*
  * 返回指令的操作码
  */
 int opcode(int instruction) {
-  int res = 0;
-  for (int i = 31; 26 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
-  }
-  res += (instruction >> 26) & 0x1;
-  return res;
+  return (instruction >> 26) & 0x3f;
 }
 
 /*
  * 返回R型指令的功能域
  */
 int func(int instruction) {
-  int res = 0;
-  for (int i = 10; 0 < i; i--) {
-    res += (instruction >> i) & 0x1;
-    res <<= 1;
+  return instruction & 0x7ff;
+}
+
+/*
+ * 按操作码查表得到指令格式, 功能单元类别和执行周期数.
+ * 表中没有的操作码 (数据) 与 J 型指令一样占用一个整数单元.
+ */
+opInfo opTable[NUMOPCODES] = {
+  [regRegALU] = {FORMAT_R, UNIT_INT,    LAT_INT,    FU_ALU},
+  [ADDI]      = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [ANDI]      = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [ORI]       = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [XORI]      = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [SLTI]      = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [SLLI]      = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [SRLI]      = {FORMAT_I, UNIT_INT,    LAT_INT,    FU_ALU},
+  [BEQZ]      = {FORMAT_I, UNIT_BRANCH, LAT_BRANCH, FU_BRANCH},
+  [BNEZ]      = {FORMAT_I, UNIT_BRANCH, LAT_BRANCH, FU_BRANCH},
+  [LW]        = {FORMAT_I, UNIT_LOAD,   LAT_LOAD,   FU_AGU},
+  [SW]        = {FORMAT_I, UNIT_STORE,  LAT_STORE,  FU_AGU},
+  [J]         = {FORMAT_J, UNIT_BRANCH, LAT_INT,    FU_BRANCH},
+  [JAL]       = {FORMAT_J, UNIT_BRANCH, LAT_INT,    FU_BRANCH},
+  [JR]        = {FORMAT_I, UNIT_BRANCH, LAT_INT,    FU_BRANCH},
+  [HALT]      = {FORMAT_J, UNIT_INT,    LAT_INT,    FU_ALU},
+  [NOOP]      = {FORMAT_J, UNIT_INT,    LAT_INT,    FU_ALU},
+};
+
+/*
+ * 将一条指令解码成 decodedInstr
+ */
+void decodeInstr(int instr, decodedInstr *d) {
+  int op = opcode(instr);
+  d->instr = instr;
+  d->op = op;
+  d->func = func(instr);
+  d->rs1 = field0(instr);
+  d->rs2 = field1(instr);
+  d->imm = (op == J || op == JAL) ? jumpAddr(instr) : immediate(instr);  // 跳转偏移量有 26 位
+  d->format = opTable[op].format;
+  d->unitClass = opTable[op].unitClass;
+  d->latClass = opTable[op].latClass;
+  d->fuClass = opTable[op].fuClass;
+  if (d->format == 0) {  // 数据
+    d->format = FORMAT_J;
+    d->unitClass = UNIT_INT;
+    d->latClass = LAT_INT;
+    d->fuClass = FU_ALU;
   }
-  res += instruction & 0x1;
-  return res;
-  return 0;
+  if (op == regRegALU && (d->func == mulFunc || d->func == divFunc)) {  // 乘除法按功能码区分
+    d->unitClass = UNIT_MUL;
+    d->latClass = (d->func == mulFunc) ? LAT_MUL : LAT_DIV;
+    d->fuClass = (d->func == mulFunc) ? FU_MUL : FU_DIV;
+  }
+  if (op == regRegALU) {
+    d->rd = field2(instr);
+  } else if (op == ADDI || op == ANDI || op == ORI || op == XORI || op == SLTI ||
+             op == SLLI || op == SRLI || op == LW) {
+    d->rd = field1(instr);
+  } else if (op == JAL) {
+    d->rd = LINKREG;
+  } else {
+    d->rd = -1;
+  }
+}
+
+/*
+ * 条件分支: 查 BTB 和预测器, 更新全局历史
+ */
+int isBranch(int op) {
+  return op == BEQZ || op == BNEZ;
+}
+
+/*
+ * 无条件跳转: J 和 JAL 的目标由立即数决定, JR 的目标在寄存器中
+ */
+int isJump(int op) {
+  return op == J || op == JAL || op == JR;
+}
+
+/*
+ * jumpatissue 时在取指时就跳转的指令
+ */
+int jumpsAtIssue(machineConfig *cfg, decodedInstr *d) {
+  return cfg->jumpAtIssue && (d->op == J || d->op == JAL);
+}
+
+/*
+ * 取出 pc 处的指令. 装入程序时已经对所有指令解码,
+ * 只有当该地址被 SW 改写过时才需要重新解码.
+ */
+decodedInstr *fetchDecoded(machineState *statePtr, int pc, decodedInstr *tmp) {
+  decodedInstr *d = &(statePtr->decoded[pc]);
+  int instr = readWord(statePtr, pc);
+  if (d->instr != instr) {
+    decodeInstr(instr, tmp);
+    return tmp;
+  }
+  return d;
 }
 
 void printInstruction(int instr) {
@@ -337,6 +1003,20 @@ void printInstruction(int instr) {
         strcpy(opcodeString, "sub");
       } else if (funcCode == andFunc) {
         strcpy(opcodeString, "and");
+      } else if (funcCode == orFunc) {
+        strcpy(opcodeString, "or");
+      } else if (funcCode == xorFunc) {
+        strcpy(opcodeString, "xor");
+      } else if (funcCode == sltFunc) {
+        strcpy(opcodeString, "slt");
+      } else if (funcCode == sllFunc) {
+        strcpy(opcodeString, "sll");
+      } else if (funcCode == srlFunc) {
+        strcpy(opcodeString, "srl");
+      } else if (funcCode == mulFunc) {
+        strcpy(opcodeString, "mul");
+      } else if (funcCode == divFunc) {
+        strcpy(opcodeString, "div");
       } else {
         strcpy(opcodeString, "alu");
       }
@@ -358,13 +1038,30 @@ void printInstruction(int instr) {
       strcpy(opcodeString, "andi");
       printf("%s %d %d %d\n", opcodeString, field1(instr), field0(instr),
 	          immediate(instr));
+    } else if (opcode(instr) == ORI || opcode(instr) == XORI || opcode(instr) == SLTI ||
+               opcode(instr) == SLLI || opcode(instr) == SRLI) {
+      op = opcode(instr);
+      strcpy(opcodeString, op == ORI ? "ori" : op == XORI ? "xori" : op == SLTI ? "slti" :
+                           op == SLLI ? "slli" : "srli");
+      printf("%s %d %d %d\n", opcodeString, field1(instr), field0(instr),
+	          immediate(instr));
     } else if (opcode(instr) == BEQZ) {
       strcpy(opcodeString, "beqz");
       printf("%s %d %d %d\n", opcodeString, field1(instr), field0(instr),
 	          immediate(instr));
+    } else if (opcode(instr) == BNEZ) {
+      strcpy(opcodeString, "bnez");
+      printf("%s %d %d %d\n", opcodeString, field1(instr), field0(instr),
+	          immediate(instr));
+    } else if (opcode(instr) == JR) {
+      strcpy(opcodeString, "jr");
+      printf("%s %d\n", opcodeString, field0(instr));
     } else if (opcode(instr) == J) {
       strcpy(opcodeString, "j");
       printf("%s %d\n", opcodeString, jumpAddr(instr));
+    } else if (opcode(instr) == JAL) {
+      strcpy(opcodeString, "jal");
+      printf("%s %d\n", opcodeString, jumpAddr(instr));
     } else if (opcode(instr) == HALT) {
       strcpy(opcodeString, "halt");
       printf("%s\n", opcodeString);
@@ -381,24 +1078,25 @@ void printFileInstr(machineState *statePtr, int memorySize) {
   for (int i = 16; i < memorySize; i++) {
     // code
     printf("code=");
-    printInstruction(statePtr->memory[i]);
+    printInstruction(readWord(statePtr, i));
     // instr
-    printf("instr=%d\n", statePtr->memory[i]);
+    printf("instr=%d\n", readWord(statePtr, i));
   }
 }
 
 void printFileState(machineState *statePtr, int memorySize) {
+  machineConfig *cfg = statePtr->config;
   printf("Cycle=%d\n", statePtr->cycles);
   // reorder buffer
-  for (int i = 0; i < RBSIZE; i++) {
+  for (int i = 0; i < cfg->rbSize; i++) {
     if (statePtr->reorderBuf[i].busy == 1) {
       printf("RB%d-Busy=%d\n", i, 1);
       printf("RB%d-Instr=%d\n", i, statePtr->reorderBuf[i].instr);
       if (statePtr->reorderBuf[i].instrStatus != 3) {
-        printf("RB%d-ExecUnit=%s\n", i, unitname[statePtr->reorderBuf[i].execUnit]);
+        printf("RB%d-ExecUnit=%s\n", i, cfg->unitname[statePtr->reorderBuf[i].execUnit]);
       }
       printf("RB%d-InstrStatus=%s\n", i, statename[statePtr->reorderBuf[i].instrStatus]);
-      if (opcode(statePtr->reorderBuf[i].instr) == NOOP || opcode(statePtr->reorderBuf[i].instr) == HALT) {
+      if (statePtr->reorderBuf[i].dec.op == NOOP || statePtr->reorderBuf[i].dec.op == HALT) {
         printf("RB%d-Valid=%d\n", i, 0);
       } else {
         printf("RB%d-Valid=%d\n", i, statePtr->reorderBuf[i].valid);
@@ -406,13 +1104,11 @@ void printFileState(machineState *statePtr, int memorySize) {
           printf("RB%d-Result=%d\n", i, statePtr->reorderBuf[i].result);
         }
       }
-      if (opcode(statePtr->reorderBuf[i].instr) == SW) {
+      if (statePtr->reorderBuf[i].dec.op == SW) {
         printf("RB%d-StoreAddress=%d\n", i, statePtr->reorderBuf[i].storeAddress);
       }
-      if (opcode(statePtr->reorderBuf[i].instr) == BEQZ) {
+      if (isBranch(statePtr->reorderBuf[i].dec.op)) {
         printf("RB%d-BranchCmp=%d\n", i, statePtr->reorderBuf[i].branchCmp);
-      }
-      if (opcode(statePtr->reorderBuf[i].instr == BEQZ)) {
         printf("RB%d-BranchPC=%d\n", i, statePtr->reorderBuf[i].branchPC);
       }
     } else {
@@ -420,7 +1116,7 @@ void printFileState(machineState *statePtr, int memorySize) {
     }
   }
   // reservation station
-  for (int i = 0; i < NUMUNITS; i++) {
+  for (int i = 0; i < cfg->numUnits; i++) {
     if (statePtr->reservation[i].busy == 1) {
       printf("RS%d-Busy=%d\n", i, 1);
       printf("RS%d-Instr=%d\n", i, statePtr->reservation[i].instr);
@@ -439,7 +1135,7 @@ void printFileState(machineState *statePtr, int memorySize) {
     }
   }
   // branch target table
-  for (int i = 0; i < BTBSIZE; i++) {
+  for (int i = 0; i < cfg->btbSize; i++) {
     if (statePtr->btBuf[i].valid) {
       printf("BT%d-Valid=%d\n", i, 1);
       printf("BT%d-BranchPC=%d\n", i, statePtr->btBuf[i].branchPC);
@@ -451,7 +1147,7 @@ void printFileState(machineState *statePtr, int memorySize) {
   }
   // register
   for (int i = 0; i < NUMREGS; i++) {
-    printf("R%d-Value=%d\n", i, statePtr->regFile[i]);
+    printf("R%d-Value=%d\n", i, regValue(statePtr, i));
     printf("R%d-Valid=%d\n", i, statePtr->regResult[i].valid);
     if (statePtr->regResult[i].valid == 0) {
       printf("R%d-ReorderNum=%d\n", i, statePtr->regResult[i].reorderNum);
@@ -459,636 +1155,3747 @@ void printFileState(machineState *statePtr, int memorySize) {
   }
   // memory
   for (int i = 0; i < memorySize; i++) {
-    printf("MEM%d-Value=%d\n", i, statePtr->memory[i]);
+    printf("MEM%d-Value=%d\n", i, readWord(statePtr, i));
   }
 }
 
-int main(int argc, char *argv[]) {
-  FILE *filePtr;
-  int pc, done, instr;
-  char line[MAXLINELENGTH];
-  machineState *statePtr;
-  int memorySize;
-  int success, newBuf, op, halt, unit;
-  int headRB, tailRB;
-  int regA, regB, immed, address;
-  int flush;
-  int rbnum;
-  
-  if (argc != 2) {
-    printf("error: usage: %s <machine-code file>\n", argv[0]);
-    exit(1);
-  }
-
-  /*
-   * 初始化, 读输入文件等
-   */
-  filePtr = fopen(argv[1], "r");
-  if (filePtr == NULL) {
-    printf("error: can't open file %s", argv[1]);
-    perror("fopen");
-    exit(1);
+/*
+ * 写入无符号 LEB128 变长整数
+ */
+void putVarint(FILE *fp, unsigned int value) {
+  while (value >= 0x80) {
+    fputc((value & 0x7f) | 0x80, fp);
+    value >>= 7;
   }
+  fputc(value, fp);
+}
 
-  /*
-   * 分配数据结构空间
-   */
-  statePtr = (machineState *) malloc(sizeof(machineState));
+/*
+ * 写入有符号整数, 先做 zigzag 编码使绝对值小的负数也很短
+ */
+void putSigned(FILE *fp, int value) {
+  putVarint(fp, ((unsigned int) value << 1) ^ (unsigned int) (value >> 31));
+}
 
-  /* 
-   * 将机器指令读入到内存中
-   */
-  for (int i = 0; i < MEMSIZE; i++) {
-    statePtr->memory[i] = 0;
-  }
-  pc = 16;
-  done = 0;
-  while (!done) {
-    if (fgets(line, MAXLINELENGTH, filePtr) == NULL){
-      done = 1;
-    } else {
-      if (sscanf(line, "%d\n", &instr) != 1) {
-          printf("error in reading address %d\n", pc);
-          exit(1);
-      }
-      statePtr->memory[pc] = instr;
-      // printf("memory[%d] = %d\n", pc, statePtr->memory[pc]);
-      // printInstruction(instr);
-      pc = pc + 1;
-    }
+/*
+ * 将机器状态按固定顺序展开成整数数组, 返回字段数.
+ * fields 为 NULL 时只计算字段数.
+ */
+int collectFields(machineState *statePtr, int memorySize, int *fields) {
+  machineConfig *cfg = statePtr->config;
+  int n = 1 + cfg->rbSize * RBFIELDS + cfg->numUnits * RSFIELDS + cfg->btbSize * BTFIELDS +
+          NUMREGS * REGFIELDS + memorySize;
+  if (fields == NULL) {
+    return n;
   }
-
-  memorySize = pc;
-  halt = 0;
-
-  // printf("\n");
-
-  /*
-   * 状态初始化
-   */
-  statePtr->pc = 16;
-  statePtr->cycles = 0;
-  for (int i = 0; i < NUMREGS; i++) {
-    statePtr->regFile[i] = 0;
+  int *p = fields;
+  *p++ = statePtr->pc;
+  for (int i = 0; i < cfg->rbSize; i++) {
+    reorderEntry *rb = &(statePtr->reorderBuf[i]);
+    *p++ = rb->busy;
+    *p++ = rb->instr;
+    *p++ = rb->execUnit;
+    *p++ = rb->instrStatus;
+    *p++ = rb->valid;
+    *p++ = rb->result;
+    *p++ = rb->storeAddress;
+    *p++ = rb->branchCmp;
+    *p++ = rb->branchPC;
   }
-  for (int i = 0; i < NUMUNITS; i++) {
-    statePtr->reservation[i].busy = 0;
+  for (int i = 0; i < cfg->numUnits; i++) {
+    resStation *rs = &(statePtr->reservation[i]);
+    *p++ = rs->busy;
+    *p++ = rs->instr;
+    *p++ = rs->Vj;
+    *p++ = rs->Vk;
+    *p++ = rs->Qj;
+    *p++ = rs->Qk;
+    *p++ = rs->exTimeLeft;
+    *p++ = rs->reorderNum;
   }
-  for (int i = 0; i < RBSIZE; i++) {
-    statePtr->reorderBuf[i].busy = 0;
+  for (int i = 0; i < cfg->btbSize; i++) {
+    btbEntry *bt = &(statePtr->btBuf[i]);
+    *p++ = bt->valid;
+    *p++ = bt->branchPC;
+    *p++ = bt->branchTarget;
+    *p++ = bt->branchPred;
   }
-
-  headRB = -1;
-  tailRB = -1;
-
   for (int i = 0; i < NUMREGS; i++) {
-    statePtr->regResult[i].valid = 1;
+    *p++ = regValue(statePtr, i);
+    *p++ = statePtr->regResult[i].valid;
+    *p++ = statePtr->regResult[i].reorderNum;
   }
-  for (int i = 0; i < BTBSIZE; i++) {
-    statePtr->btBuf[i].valid = 0;
+  for (int i = 0; i < memorySize; i++) {
+    *p++ = readWord(statePtr, i);
   }
+  return n;
+}
 
-  printFileInstr(statePtr, memorySize);
+/*
+ * 写入小端序整数
+ */
+void putLittle(FILE *fp, unsigned long long value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    fputc((value >> (8 * i)) & 0xff, fp);
+  }
+}
 
-  /*
-   * 处理指令
-   */
-  while (1) {  /* 执行循环:你应该在执行 HALT 指令时跳出这个循环 */
+/*
+ * 在索引中记录下一条记录在 trace 中的位置
+ */
+void indexRecord(traceWriter *tw) {
+  if (tw->indexFp != NULL) {
+    putLittle(tw->indexFp, ftell(tw->fp), 8);
+  }
+}
 
-    // printState(statePtr, memorySize);
+/*
+ * 输出 trace 文件头: 文本格式为程序清单, 二进制格式为部件数量和程序指令
+ */
+void traceBegin(traceWriter *tw, machineState *statePtr, int memorySize) {
+  machineConfig *cfg = statePtr->config;
+  tw->numRecords = 0;
+  if (tw->format == TRACE_NONE) {
+    return;
+  }
+  if (tw->indexFp != NULL && ftell(tw->fp) < 0) {  // 输出到管道时无法得到偏移量
+    fprintf(stderr, "warning: trace is not seekable, index not written\n");
+    fclose(tw->indexFp);
+    tw->indexFp = NULL;
+  }
+  if (tw->indexFp != NULL) {
+    fwrite(INDEX_MAGIC, 1, 4, tw->indexFp);
+    putLittle(tw->indexFp, INDEX_VERSION, 4);
+    putLittle(tw->indexFp, 0, 4);  // 记录数在结束时回填
+  }
+  if (tw->format == TRACE_TEXT) {
+    printFileInstr(statePtr, memorySize);
+    return;
+  }
+  tw->numFields = collectFields(statePtr, memorySize, NULL);
+  tw->fields = (int *) malloc(tw->numFields * sizeof(int));
+  tw->prev = (int *) malloc(tw->numFields * sizeof(int));
+  tw->hasPrev = 0;
 
+  fwrite(TRACE_MAGIC, 1, 4, tw->fp);
+  putVarint(tw->fp, TRACE_VERSION);
+  putVarint(tw->fp, tw->interval);
+  putVarint(tw->fp, cfg->rbSize);
+  putVarint(tw->fp, cfg->numUnits);
+  putVarint(tw->fp, cfg->btbSize);
+  putVarint(tw->fp, NUMREGS);
+  putVarint(tw->fp, memorySize);
+  for (int i = 0; i < cfg->numUnits; i++) {
+    putVarint(tw->fp, strlen(cfg->unitname[i]));
+    fputs(cfg->unitname[i], tw->fp);
+  }
+  for (int i = 16; i < memorySize; i++) {
+    putSigned(tw->fp, readWord(statePtr, i));
+  }
+}
+
+/*
+ * 输出一个周期的状态.
+ * 二进制格式每隔 interval 个周期写一个关键帧, 其余周期只写发生变化的字段.
+ */
+void traceCycle(traceWriter *tw, machineState *statePtr, int memorySize) {
+  if (tw->format == TRACE_NONE) {
+    return;
+  }
+  indexRecord(tw);
+  tw->numRecords++;
+  if (tw->format == TRACE_TEXT) {
     printFileState(statePtr, memorySize);
+    return;
+  }
+  collectFields(statePtr, memorySize, tw->fields);
+  if (!tw->hasPrev || statePtr->cycles % tw->interval == 0) {
+    fputc(TRACE_KEYFRAME, tw->fp);
+    putVarint(tw->fp, statePtr->cycles);
+    for (int i = 0; i < tw->numFields; i++) {
+      putSigned(tw->fp, tw->fields[i]);
+    }
+  } else {
+    int changed = 0;
+    for (int i = 0; i < tw->numFields; i++) {
+      if (tw->fields[i] != tw->prev[i]) {
+        changed++;
+      }
+    }
+    fputc(TRACE_DELTA, tw->fp);
+    putVarint(tw->fp, statePtr->cycles);
+    putVarint(tw->fp, changed);
+    int last = 0;
+    for (int i = 0; i < tw->numFields; i++) {
+      if (tw->fields[i] != tw->prev[i]) {
+        putVarint(tw->fp, i - last);
+        putSigned(tw->fp, tw->fields[i]);
+        last = i;
+      }
+    }
+  }
+  int *tmp = tw->prev;
+  tw->prev = tw->fields;
+  tw->fields = tmp;
+  tw->hasPrev = 1;
+}
+
+/*
+ * 输出停机时的状态和总周期数
+ */
+void traceEnd(traceWriter *tw, machineState *statePtr, int memorySize) {
+  if (tw->format == TRACE_NONE) {
+    return;
+  }
+  traceCycle(tw, statePtr, memorySize);
+  indexRecord(tw);
+  if (tw->format == TRACE_TEXT) {
+    printf("%d", statePtr->cycles);
+  } else {
+    fputc(TRACE_END, tw->fp);
+    putVarint(tw->fp, statePtr->cycles);
+    free(tw->fields);
+    free(tw->prev);
+  }
+  fflush(tw->fp);
+  if (tw->indexFp != NULL) {
+    fseek(tw->indexFp, 8, SEEK_SET);
+    putLittle(tw->indexFp, tw->numRecords, 4);
+    fclose(tw->indexFp);
+  }
+}
+
+/*
+ * 输出的统计项: 快速模式下的名称和参数扫描结果中的列名
+ */
+typedef struct _statKey {
+  char *name;
+  char *column;
+  size_t offset;  // 在 simStats 中的位置
+} statKey;
+
+statKey statKeys[] = {
+  {"Instructions", "instructions", offsetof(simStats, instructions)},
+  {"Branches",     "branches",     offsetof(simStats, branches)},
+  {"Mispredicts",  "mispredicts",  offsetof(simStats, mispredicts)},
+  {"Jumps",        "jumps",        offsetof(simStats, jumps)},
+  {"Flushes",      "flushes",      offsetof(simStats, flushes)},
+  {"Forwards",     "forwards",     offsetof(simStats, forwards)},
+  {"Replays",      "replays",      offsetof(simStats, replays)},
+  {"LoadWaits",    "loadwaits",    offsetof(simStats, loadWaits)},
+  {"BtbHits",      "btbhits",      offsetof(simStats, btbHits)},
+  {"BtbMisses",    "btbmisses",    offsetof(simStats, btbMisses)},
+  {"BtbEvictions", "btbevictions", offsetof(simStats, btbEvictions)},
+  {"PenaltyCycles", "penaltycycles", offsetof(simStats, penaltyCycles)},
+  {"CdbStalls",    "cdbstalls",    offsetof(simStats, cdbStalls)},
+  {"SkippedCycles", "skippedcycles", offsetof(simStats, skippedCycles)},
+  {"L1Hits",       "l1hits",       offsetof(simStats, cacheHits[L1])},
+  {"L1Misses",     "l1misses",     offsetof(simStats, cacheMisses[L1])},
+  {"L2Hits",       "l2hits",       offsetof(simStats, cacheHits[L2])},
+  {"L2Misses",     "l2misses",     offsetof(simStats, cacheMisses[L2])},
+  {"MshrMerges",   "mshrmerges",   offsetof(simStats, mshrMerges)},
+  {"MshrStalls",   "mshrstalls",   offsetof(simStats, mshrStalls)},
+  {"Writebacks",   "writebacks",   offsetof(simStats, writebacks)},
+  {"WriteThroughs", "writethroughs", offsetof(simStats, writeThroughs)},
+  {"MemAccesses",  "memaccesses",  offsetof(simStats, memAccesses)},
+  {"MemCycles",    "memcycles",    offsetof(simStats, memCycles)},
+  {"L1IHits",      "l1ihits",      offsetof(simStats, cacheHits[L1I])},
+  {"L1IMisses",    "l1imisses",    offsetof(simStats, cacheMisses[L1I])},
+  {"FetchBubbles", "fetchbubbles", offsetof(simStats, fetchBubbles)},
+  {"FetchQueueFull", "fetchqueuefull", offsetof(simStats, fetchQueueFull)},
+  {"IcacheStalls", "icachestalls", offsetof(simStats, icacheStalls)},
+  {"IssueCycles",  "issuecycles",  offsetof(simStats, cycleCauses[CYCLE_ISSUE])},
+  {"FlushCycles",  "flushcycles",  offsetof(simStats, cycleCauses[CYCLE_FLUSH])},
+  {"HaltCycles",   "haltcycles",   offsetof(simStats, cycleCauses[CYCLE_HALT])},
+  {"RobFullCycles", "robfullcycles", offsetof(simStats, cycleCauses[CYCLE_ROBFULL])},
+  {"FrontEndCycles", "frontendcycles", offsetof(simStats, cycleCauses[CYCLE_FRONTEND])},
+  {"OperandCycles", "operandcycles", offsetof(simStats, cycleCauses[CYCLE_OPERAND])},
+  {"RegFullCycles", "regfullcycles", offsetof(simStats, cycleCauses[CYCLE_REGFULL])},
+  {"LoadFullCycles", "loadfullcycles", offsetof(simStats, cycleCauses[CYCLE_RSFULL + UNIT_LOAD])},
+  {"StoreFullCycles", "storefullcycles", offsetof(simStats, cycleCauses[CYCLE_RSFULL + UNIT_STORE])},
+  {"IntFullCycles", "intfullcycles", offsetof(simStats, cycleCauses[CYCLE_RSFULL + UNIT_INT])},
+  {"BranchFullCycles", "branchfullcycles", offsetof(simStats, cycleCauses[CYCLE_RSFULL + UNIT_BRANCH])},
+  {"MulFullCycles", "mulfullcycles", offsetof(simStats, cycleCauses[CYCLE_RSFULL + UNIT_MUL])},
+  {"FuStalls",     "fustalls",     offsetof(simStats, fuStalls)},
+};
+#define NUMSTATKEYS (sizeof(statKeys) / sizeof(statKeys[0]))
+
+long long statValue(simStats *st, int k) {
+  return *(long long *) ((char *) st + statKeys[k].offset);
+}
+
+/*
+ * 分支预测的准确率和每千条指令的预测错误数
+ */
+double accuracy(simStats *st) {
+  return st->branches ? 1.0 - (double) st->mispredicts / st->branches : 0.0;
+}
+
+double mpki(simStats *st) {
+  return st->instructions ? 1000.0 * st->mispredicts / st->instructions : 0.0;
+}
+
+/*
+ * 每级 cache 的命中率和 LW/SW 的平均执行周期数
+ */
+double hitRate(simStats *st, int level) {
+  long long accesses = st->cacheHits[level] + st->cacheMisses[level];
+  return accesses ? (double) st->cacheHits[level] / accesses : 0.0;
+}
+
+double avgMemLatency(simStats *st) {
+  return st->memAccesses ? (double) st->memCycles / st->memAccesses : 0.0;
+}
+
+/*
+ * 快速模式下停机时的输出: 寄存器, 内存, 周期数和统计, 仍使用 KEY=value 格式
+ */
+void printSummary(machineState *statePtr, int memorySize, double seconds) {
+  simStats *st = &(statePtr->stats);
+  for (int i = 0; i < NUMREGS; i++) {
+    printf("R%d-Value=%d\n", i, regValue(statePtr, i));
+  }
+  for (int i = 0; i < memorySize; i++) {
+    printf("MEM%d-Value=%d\n", i, readWord(statePtr, i));
+  }
+  printf("Cycles=%d\n", statePtr->cycles);
+  if (statePtr->fault) {
+    printf("Fault=%u\n", statePtr->faultAddress);
+    printf("FaultPC=%d\n", statePtr->faultPC);
+  }
+  printf("IPC=%.4f\n", statePtr->cycles ? (double) st->instructions / statePtr->cycles : 0.0);
+  for (int k = 0; k < NUMSTATKEYS; k++) {
+    printf("%s=%lld\n", statKeys[k].name, statValue(st, k));
+  }
+  printf("Predictor=%s\n", predictorName[statePtr->config->predictor]);
+  printf("Accuracy=%.4f\n", accuracy(st));
+  printf("MPKI=%.4f\n", mpki(st));
+  printf("AvgPenalty=%.2f\n", st->flushes ? (double) st->penaltyCycles / st->flushes : 0.0);
+  printf("L1HitRate=%.4f\n", hitRate(st, L1));
+  printf("L2HitRate=%.4f\n", hitRate(st, L2));
+  printf("L1IHitRate=%.4f\n", hitRate(st, L1I));
+  printf("AvgMemLatency=%.2f\n", avgMemLatency(st));
+  for (int u = 0; u < statePtr->config->numUnits; u++) {
+    printf("%s-Busy=%.4f\n", statePtr->config->unitname[u],
+           statePtr->cycles ? (double) statePtr->unitBusy[u] / statePtr->cycles : 0.0);
+  }
+  for (int k = 0; k <= statePtr->config->rbSize; k++) {
+    printf("ROB%d-Cycles=%lld\n", k, statePtr->robHist[k]);
+  }
+  printf("Seconds=%.6f\n", seconds);
+  printf("CyclesPerSecond=%.0f\n", seconds > 0 ? statePtr->cycles / seconds : 0.0);
+}
+
+/*
+ * 停机时的性能报告, JSON 格式: 周期分类, 每个保留站的占用率, ROB 占用的直方图和全部统计
+ */
+void writeReport(FILE *fp, machineState *statePtr) {
+  machineConfig *cfg = statePtr->config;
+  simStats *st = &(statePtr->stats);
+  int cycles = statePtr->cycles;
+  fprintf(fp, "{\n  \"cycles\": %d,\n  \"instructions\": %lld,\n", cycles, st->instructions);
+  fprintf(fp, "  \"ipc\": %.4f,\n", cycles ? (double) st->instructions / cycles : 0.0);
+  fprintf(fp, "  \"cycleCauses\": {");
+  char *causeName[NUMCAUSES] = {"issue", "flush", "halt", "robFull", "frontEnd", "operand", "regFull"};
+  for (int c = 0; c < NUMCLASSES; c++) {
+    causeName[CYCLE_RSFULL + c] = classname[c];
+  }
+  for (int k = 0; k < NUMCAUSES; k++) {
+    fprintf(fp, "%s\"%s\": %lld", k ? ", " : "", causeName[k], st->cycleCauses[k]);
+  }
+  fprintf(fp, "},\n  \"units\": [");
+  for (int u = 0; u < cfg->numUnits; u++) {
+    fprintf(fp, "%s\n    {\"name\": \"%s\", \"busyCycles\": %lld, \"busy\": %.4f}", u ? "," : "",
+            cfg->unitname[u], statePtr->unitBusy[u], cycles ? (double) statePtr->unitBusy[u] / cycles : 0.0);
+  }
+  fprintf(fp, "\n  ],\n  \"robOccupancy\": [");
+  for (int k = 0; k <= cfg->rbSize; k++) {
+    fprintf(fp, "%s%lld", k ? ", " : "", statePtr->robHist[k]);
+  }
+  fprintf(fp, "],\n  \"stats\": {");
+  for (int k = 0; k < NUMSTATKEYS; k++) {
+    fprintf(fp, "%s\n    \"%s\": %lld", k ? "," : "", statKeys[k].column, statValue(st, k));
+  }
+  fprintf(fp, "\n  }\n}\n");
+}
+
+/*
+ * 返回以秒为单位的单调时钟
+ */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * ROB 循环队列中 i 的下一项
+ */
+int nextRB(machineConfig *cfg, int i) {
+  return (i + 1 == cfg->rbSize) ? 0 : i + 1;
+}
+
+/*
+ * ROB 循环队列中 i 的上一项
+ */
+int prevRB(machineConfig *cfg, int i) {
+  return (i == 0) ? cfg->rbSize - 1 : i - 1;
+}
+
+/*
+ * ROB 中的指令数
+ */
+int robCount(machineState *statePtr, int headRB, int tailRB) {
+  machineConfig *cfg = statePtr->config;
+  if (headRB == -1 || !statePtr->reorderBuf[headRB].busy) {  // 队列为空, 或队首已提交
+    return 0;
+  }
+  return (headRB <= tailRB) ? tailRB - headRB + 1 : cfg->rbSize + tailRB - headRB + 1;
+}
+
+/*
+ * 指令实际使用的保留站类别: 没有配置该类保留站时使用 INT 保留站
+ */
+int stationClass(machineConfig *cfg, int unitClass) {
+  return (cfg->units[unitClass] > 0) ? unitClass : UNIT_INT;
+}
+
+/*
+ * 返回指定类别中第一个空闲的保留站, 没有则返回 -1
+ */
+int freeUnit(machineState *statePtr, int unitClass) {
+  machineConfig *cfg = statePtr->config;
+  unitClass = stationClass(cfg, unitClass);
+  for (int i = 0; i < cfg->numUnits; i++) {
+    if (cfg->unitclass[i] == unitClass && !statePtr->reservation[i].busy) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * 发射时读取源寄存器:
+ * 寄存器有效则读寄存器, 结果已写入 ROB 则读 ROB, 否则记下将产生结果的 ROB 项编号.
+ * 物理寄存器模式下读映射到的物理寄存器, 还没有写回时同样记下 ROB 项编号.
+ */
+void readOperand(machineState *statePtr, int reg, int *V, int *Q) {
+  if (statePtr->config->physRegs > 0) {
+    int p = statePtr->renameMap[reg];
+    if (statePtr->physReady[p]) {
+      *V = statePtr->physFile[p];
+      *Q = -1;
+    } else {
+      *Q = statePtr->regResult[reg].reorderNum;
+    }
+    return;
+  }
+  if (statePtr->regResult[reg].valid == 1) {
+    *V = statePtr->regFile[reg];
+    *Q = -1;
+  } else {
+    int reorderNum = statePtr->regResult[reg].reorderNum;
+    if (statePtr->reorderBuf[reorderNum].instrStatus == COMMITTING) {
+      *V = statePtr->reorderBuf[reorderNum].result;
+      *Q = -1;
+    } else {
+      *Q = reorderNum;
+    }
+  }
+}
+
+/*
+ * 等待者链表: 发射时操作数还没有准备好的保留站挂在产生结果的 ROB 项上,
+ * 写回时只唤醒链表中的保留站. 节点编号为 保留站 * 2 + 操作数 (0 为 j, 1 为 k).
+ */
+void addConsumer(machineState *statePtr, int tag, int unit, int operand) {
+  int node = unit * 2 + operand;
+  statePtr->consumerNext[node] = statePtr->consumerHead[tag];
+  statePtr->consumerHead[tag] = node;
+}
+
+void wakeup(machineState *statePtr, int tag, int result) {
+  for (int node = statePtr->consumerHead[tag]; node != -1; node = statePtr->consumerNext[node]) {
+    resStation *rs = &(statePtr->reservation[node >> 1]);
+    if (!rs->busy) {
+      continue;
+    }
+    if ((node & 1) == 0 && rs->Qj == tag) {
+      rs->Qj = -1;
+      rs->Vj = result;
+    } else if ((node & 1) == 1 && rs->Qk == tag) {
+      rs->Qk = -1;
+      rs->Vk = result;
+    }
+  }
+  statePtr->consumerHead[tag] = -1;
+}
+
+/*
+ * 清除指令后保留站可能被重新使用, 按仍在等待的保留站重建所有链表
+ */
+void rebuildConsumers(machineState *statePtr) {
+  machineConfig *cfg = statePtr->config;
+  for (int i = 0; i < cfg->rbSize; i++) {
+    statePtr->consumerHead[i] = -1;
+  }
+  for (int u = 0; u < cfg->numUnits; u++) {
+    resStation *rs = &(statePtr->reservation[u]);
+    if (rs->busy && rs->Qj != -1) {
+      addConsumer(statePtr, rs->Qj, u, 0);
+    }
+    if (rs->busy && rs->Qk != -1) {
+      addConsumer(statePtr, rs->Qk, u, 1);
+    }
+  }
+}
+
+/*
+ * 计算 ROB 项 i 中 load 指令的结果, 它的地址已经在保留站中准备好.
+ * 从 i 向队首查找更老的 store:
+ *     地址相同且已经算出地址的 store, 直接转发它的数据;
+ *     地址还未算出的 store, 不推测时等待 (返回 0), 推测时越过它继续查找.
+ * 没有匹配的 store 则读内存. 记下数据来源, 供 store 算出地址时检查冲突.
+ */
+int loadValue(machineState *statePtr, int headRB, int i, int *result) {
+  machineConfig *cfg = statePtr->config;
+  reorderEntry *load = &(statePtr->reorderBuf[i]);
+  int address = statePtr->reservation[load->execUnit].Vj + load->dec.imm;
+  for (int j = i; j != headRB; ) {
+    j = prevRB(cfg, j);
+    reorderEntry *store = &(statePtr->reorderBuf[j]);
+    if (!store->busy || store->dec.op != SW) {
+      continue;
+    }
+    if (store->instrStatus != COMMITTING) {
+      if (!cfg->memSpec) {
+        return 0;
+      }
+    } else if (store->storeAddress == address) {
+      load->loadAddress = address;
+      load->loadSource = store->seq;
+      *result = store->result;
+      statePtr->stats.forwards++;
+      return 1;
+    }
+  }
+  load->loadAddress = address;
+  load->loadSource = -1;
+  *result = readWord(statePtr, address);
+  return 1;
+}
+
+/*
+ * ROB 项 i 中的 store 刚算出地址, 检查更年轻的已经完成的 load:
+ * 地址相同, 而数据来自内存或比这条 store 更老的 store, 说明 load 读到了旧值.
+ * 返回最老的这样的 load, 没有则返回 -1.
+ */
+int orderViolation(machineState *statePtr, int tailRB, int i) {
+  machineConfig *cfg = statePtr->config;
+  reorderEntry *store = &(statePtr->reorderBuf[i]);
+  for (int j = i; j != tailRB; ) {
+    j = nextRB(cfg, j);
+    reorderEntry *load = &(statePtr->reorderBuf[j]);
+    if (load->busy && load->dec.op == LW && load->instrStatus == COMMITTING &&
+        load->loadAddress == store->storeAddress && load->loadSource < store->seq) {
+      return j;
+    }
+  }
+  return -1;
+}
+
+/*
+ * 清除 ROB 中从 first 到队尾的指令, 释放它们的保留站, 恢复全局分支历史
+ */
+void squashFrom(machineState *statePtr, int headRB, int tailRB, int first) {
+  machineConfig *cfg = statePtr->config;
+  int restored = 0;
+  for (int i = first; ; i = nextRB(cfg, i)) {
+    reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+    if (RBPtr->busy && RBPtr->execUnit != -1) {
+      resStation *rs = &(statePtr->reservation[RBPtr->execUnit]);
+      if (rs->busy && rs->reorderNum == i) {
+        rs->busy = 0;
+      }
+    }
+    if (RBPtr->busy && RBPtr->dec.op == HALT) {
+      statePtr->haltsInFlight--;
+    }
+    if (RBPtr->busy && isBranch(RBPtr->dec.op) && !restored) {
+      statePtr->ghr = RBPtr->predHist;  // 恢复到被清除的最老的分支发射前的历史
+      restored = 1;
+    }
+    RBPtr->busy = 0;
+    if (i == tailRB) {
+      break;
+    }
+  }
+  rebuildConsumers(statePtr);
+}
+
+/*
+ * 根据队首到 first 之前的指令重建寄存器状态
+ */
+void rebuildRegResult(machineState *statePtr, int headRB, int first) {
+  machineConfig *cfg = statePtr->config;
+  for (int i = 0; i < NUMREGS; i++) {
+    statePtr->regResult[i].valid = 1;
+  }
+  for (int i = headRB; i != first; i = nextRB(cfg, i)) {
+    int rd = statePtr->reorderBuf[i].dec.rd;
+    if (statePtr->reorderBuf[i].busy && rd != -1) {
+      statePtr->regResult[rd].valid = 0;
+      statePtr->regResult[rd].reorderNum = i;
+    }
+  }
+}
+
+/*
+ * 从 ROB 项 i 的分支发射时保存的检查点恢复寄存器状态.
+ * 检查点在分支自己重命名之后保存, 所以 JAL 的 r31 仍然等待这条 JAL;
+ * 检查点之后已经提交的指令不再等待, 改为读寄存器.
+ */
+void restoreCheckpoint(machineState *statePtr, int i) {
+  regResultEntry *checkpoint = &(statePtr->checkpoints[i * NUMREGS]);
+  for (int r = 0; r < NUMREGS; r++) {
+    reorderEntry *producer = &(statePtr->reorderBuf[checkpoint[r].reorderNum]);
+    if (checkpoint[r].valid == 0 && producer->busy && producer->seq <= statePtr->reorderBuf[i].seq) {
+      statePtr->regResult[r] = checkpoint[r];
+    } else {
+      statePtr->regResult[r].valid = 1;
+    }
+  }
+}
+
+/*
+ * 物理寄存器模式下清除指令后重建重命名表和空闲表: 从已提交的映射开始,
+ * 依次加上队首到 first 之前的指令分配的物理寄存器, 其余的物理寄存器都空闲.
+ */
+void rebuildRenameMap(machineState *statePtr, int headRB, int first) {
+  machineConfig *cfg = statePtr->config;
+  if (cfg->physRegs == 0) {
+    return;
+  }
+  memset(statePtr->physMark, 0, cfg->physRegs * sizeof(int));
+  for (int r = 0; r < NUMREGS; r++) {
+    statePtr->renameMap[r] = statePtr->archMap[r];
+    statePtr->physMark[statePtr->archMap[r]] = 1;
+  }
+  for (int i = headRB; i != first; i = nextRB(cfg, i)) {
+    reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+    if (RBPtr->busy && RBPtr->dec.rd != -1) {
+      statePtr->renameMap[RBPtr->dec.rd] = RBPtr->physDest;
+      statePtr->physMark[RBPtr->physDest] = 1;
+    }
+  }
+  statePtr->freeCount = 0;
+  for (int p = cfg->physRegs - 1; p >= 0; p--) {
+    if (!statePtr->physMark[p]) {
+      statePtr->freeList[statePtr->freeCount++] = p;
+    }
+  }
+}
+
+/*
+ * 物理寄存器模式下发射时为 ROB 项 i 的目的寄存器分配一个空闲的物理寄存器, 返回它的编号
+ */
+int renameDest(machineState *statePtr, int i) {
+  reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+  int p = statePtr->freeList[--statePtr->freeCount];
+  RBPtr->physDest = p;
+  RBPtr->oldPhys = statePtr->renameMap[RBPtr->dec.rd];
+  statePtr->renameMap[RBPtr->dec.rd] = p;
+  statePtr->physReady[p] = 0;
+  return p;
+}
+
+/*
+ * 跳转指令的目标: JAL 的结果是返回地址, 目标由立即数算出; J 和 JR 的结果就是目标
+ */
+int jumpTarget(reorderEntry *RBPtr) {
+  if (RBPtr->dec.op == JAL) {
+    return RBPtr->pc + 1 + RBPtr->dec.imm;
+  }
+  return RBPtr->result;
+}
+
+/*
+ * 提交 ROB 项 i 的寄存器结果. 物理寄存器模式下结果已经在物理寄存器中,
+ * 只需修改已提交的映射, 并释放这个寄存器原来映射的物理寄存器.
+ */
+void commitRegister(machineState *statePtr, int i) {
+  reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+  int rd = RBPtr->dec.rd;
+  if (statePtr->config->physRegs > 0) {
+    statePtr->archMap[rd] = RBPtr->physDest;
+    statePtr->freeList[statePtr->freeCount++] = RBPtr->oldPhys;
+  } else if (RBPtr->valid == 1) {
+    // 即使后面还有指令写同一个寄存器也要写回, 后面的指令可能被清除
+    statePtr->regFile[rd] = RBPtr->result;
+  }
+  if (!statePtr->regResult[rd].valid && statePtr->regResult[rd].reorderNum == i) {
+    statePtr->regResult[rd].valid = 1;
+  }
+}
+
+/*
+ * 从 pc 重新取指: 丢弃取指队列中的指令, 全局历史恢复到其中最老的分支取指前的值.
+ * ROB 中被清除的分支更老, 调用者随后会按它们设置全局历史.
+ */
+void redirectFetch(machineState *statePtr, int pc) {
+  machineConfig *cfg = statePtr->config;
+  for (int n = 0; n < statePtr->fqCount; n++) {
+    fetchEntry *fe = &(statePtr->fetchQueue[(statePtr->fqHead + n) % cfg->fetchQueue]);
+    if (isBranch(fe->dec.op)) {
+      statePtr->ghr = fe->predHist;
+      break;
+    }
+  }
+  statePtr->fqHead = 0;
+  statePtr->fqCount = 0;
+  statePtr->pc = pc;
+}
+
+/*
+ * 分支或跳转在执行完成时确定结果 (cfg->earlyResolve).
+ * 如果发射时预测的 PC 不对, 清除 ROB 项 i 之后的指令, 恢复寄存器状态和全局历史, 并修改 PC;
+ * 预测错误的统计留到提交时进行, 因为这条分支本身也可能被更老的分支清除.
+ * 返回 1 表示清除了更年轻的指令.
+ */
+int resolveBranch(machineState *statePtr, int headRB, int tailRB, int i) {
+  reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+  int taken = (isJump(RBPtr->dec.op) || RBPtr->branchCmp == 1) ? TAKEN : NOTTAKEN;
+  int nextPC = isJump(RBPtr->dec.op) ? jumpTarget(RBPtr) : (taken == TAKEN) ? RBPtr->result : RBPtr->pc + 1;
+  RBPtr->resolved = 1;
+  RBPtr->resolveCycle = statePtr->cycles;
+  if (nextPC == RBPtr->predPC) {
+    return 0;
+  }
+  RBPtr->mispredicted = 1;
+  // 分支是 ROB 的最后一项时没有指令被清除, 重命名表不变.
+  // ROB 满时 i 的下一项就是队首, 这时重建会把所有在途的物理寄存器当作空闲.
+  if (i != tailRB) {
+    squashFrom(statePtr, headRB, tailRB, nextRB(statePtr->config, i));
+    rebuildRenameMap(statePtr, headRB, nextRB(statePtr->config, i));
+  }
+  restoreCheckpoint(statePtr, i);
+  redirectFetch(statePtr, nextPC);
+  statePtr->ghr = isBranch(RBPtr->dec.op) ? (RBPtr->predHist << 1) | taken : RBPtr->predHist;
+  return 1;
+}
+
+/*
+ * 清空流水线: ROB, 保留站和寄存器状态
+ */
+void flushPipeline(machineState *statePtr) {
+  machineConfig *cfg = statePtr->config;
+  // 清空 ROB
+  for (int i = 0; i < cfg->rbSize; i++) {
+    statePtr->reorderBuf[i].busy = 0;
+  }
+  // 清空保留站
+  for (int i = 0; i < cfg->numUnits; i++) {
+    statePtr->reservation[i].busy = 0;
+  }
+  // 清空寄存器状态
+  for (int i = 0; i < NUMREGS; i++) {
+    statePtr->regResult[i].valid = 1;
+  }
+  // 清空等待者链表
+  for (int i = 0; i < cfg->rbSize; i++) {
+    statePtr->consumerHead[i] = -1;
+  }
+  statePtr->haltsInFlight = 0;
+  // 重命名表恢复为已提交的映射
+  rebuildRenameMap(statePtr, 0, 0);
+}
+
+/*
+ * BTB 是 btbSize / btbWays 组的组相联表, 第 s 组占用 btBuf[s * btbWays] 开始的 btbWays 项.
+ * pc 所在的组: 用 PC 的低位和更高一段的位异或选组, 使步长为 2 的幂的分支不会挤在同几组中
+ */
+btbEntry *btbSet(machineState *statePtr, int pc) {
+  machineConfig *cfg = statePtr->config;
+  int numSets = cfg->btbSize / cfg->btbWays;
+  return &(statePtr->btBuf[((pc ^ (pc / numSets)) % numSets) * cfg->btbWays]);
+}
+
+/*
+ * 在 BTB 中查找 pc 对应的项, 没有则返回 NULL
+ */
+btbEntry *btbLookup(machineState *statePtr, int pc) {
+  btbEntry *set = btbSet(statePtr, pc);
+  for (int i = 0; i < statePtr->config->btbWays; i++) {
+    if (set[i].valid == 1 && set[i].branchPC == pc) {
+      return &set[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * 取条件分支或 JR 时访问 BTB: 命中时更新 LRU 时间并返回该项.
+ * 缺失时为 pc 新建一项, 预测不跳转, 组内已满时替换最久未使用的项, 返回 NULL.
+ */
+btbEntry *btbAccess(machineState *statePtr, int pc) {
+  btbEntry *entry = btbLookup(statePtr, pc);
+  statePtr->btbClock++;
+  if (entry != NULL) {
+    statePtr->stats.btbHits++;
+    entry->lastUse = statePtr->btbClock;
+    return entry;
+  }
+  statePtr->stats.btbMisses++;
+  btbEntry *set = btbSet(statePtr, pc);
+  entry = &set[0];
+  for (int i = 0; i < statePtr->config->btbWays; i++) {
+    if (set[i].valid == 0) {
+      entry = &set[i];
+      break;
+    }
+    if (set[i].lastUse < entry->lastUse) {
+      entry = &set[i];
+    }
+  }
+  if (entry->valid) {
+    statePtr->stats.btbEvictions++;
+  }
+  entry->valid = 1;
+  entry->branchPC = pc;
+  entry->branchPred = STRONGNOT;
+  entry->branchTarget = pc + 1;
+  entry->lastUse = statePtr->btbClock;
+  return NULL;
+}
+
+/*
+ * 返回指定类别中本周期可以开始一条新指令的执行部件, 没有则返回 -1
+ */
+int freeFU(machineState *statePtr, int fuClass) {
+  machineConfig *cfg = statePtr->config;
+  for (int i = cfg->fuBase[fuClass]; i < cfg->fuBase[fuClass] + cfg->fus[fuClass]; i++) {
+    if (statePtr->fuFree[i] <= statePtr->cycles) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * 第 level 级 cache 是组相联表, 每组 cacheWays 块, 第 s 组占用 cache[level][s * cacheWays] 开始的项.
+ * 块地址对组数取模选组.
+ */
+cacheLine *cacheSet(machineState *statePtr, int level, unsigned int block) {
+  machineConfig *cfg = statePtr->config;
+  int numSets = cfg->cacheSize[level] / cfg->lineSize[level] / cfg->cacheWays[level];
+  return &(statePtr->cache[level][(block % numSets) * cfg->cacheWays[level]]);
+}
+
+/*
+ * 在第 level 级 cache 中查找块, 命中时更新 LRU 时间并返回该块, 缺失返回 NULL
+ */
+cacheLine *cacheLookup(machineState *statePtr, int level, unsigned int block) {
+  cacheLine *set = cacheSet(statePtr, level, block);
+  statePtr->cacheClock++;
+  for (int i = 0; i < statePtr->config->cacheWays[level]; i++) {
+    if (set[i].valid && set[i].block == block) {
+      set[i].lastUse = statePtr->cacheClock;
+      return &set[i];
+    }
+  }
+  return NULL;
+}
+
+void cacheFill(machineState *statePtr, int level, unsigned int block, int dirty);
+
+/*
+ * 把第 level 级的块 block 写到下一级: L1 的下一级是 L2 时写入 L2 (缺失时分配), 否则写内存
+ */
+void writeNext(machineState *statePtr, int level, unsigned int block) {
+  machineConfig *cfg = statePtr->config;
+  if (level == L1 && cfg->cacheSize[L2] > 0) {
+    unsigned int next = block * cfg->lineSize[L1] / cfg->lineSize[L2];
+    cacheLine *line = cacheLookup(statePtr, L2, next);
+    if (line != NULL) {
+      line->dirty = 1;
+    } else {
+      cacheFill(statePtr, L2, next, 1);
+    }
+  }
+}
+
+/*
+ * 把块装入第 level 级 cache, 组内已满时替换最久未使用的块, 被替换的脏块写到下一级
+ */
+void cacheFill(machineState *statePtr, int level, unsigned int block, int dirty) {
+  cacheLine *set = cacheSet(statePtr, level, block);
+  cacheLine *line = &set[0];
+  for (int i = 0; i < statePtr->config->cacheWays[level]; i++) {
+    if (!set[i].valid) {
+      line = &set[i];
+      break;
+    }
+    if (set[i].lastUse < line->lastUse) {
+      line = &set[i];
+    }
+  }
+  if (line->valid && line->dirty) {
+    statePtr->stats.writebacks++;
+    writeNext(statePtr, level, line->block);
+  }
+  line->valid = 1;
+  line->dirty = dirty;
+  line->block = block;
+  line->lastUse = ++statePtr->cacheClock;
+}
+
+/*
+ * 第一级 cache 缺失时从 L2 或内存取 address 所在的块, 返回增加的周期数
+ */
+int missLatency(machineState *statePtr, unsigned int address) {
+  machineConfig *cfg = statePtr->config;
+  if (cfg->cacheSize[L2] == 0) {
+    return cfg->memLat;
+  }
+  unsigned int block = address / cfg->lineSize[L2];
+  if (cacheLookup(statePtr, L2, block) != NULL) {
+    statePtr->stats.cacheHits[L2]++;
+    return cfg->cacheLat[L2];
+  }
+  statePtr->stats.cacheMisses[L2]++;
+  cacheFill(statePtr, L2, block, 0);
+  return cfg->cacheLat[L2] + cfg->memLat;
+}
+
+/*
+ * LW/SW 算出地址, 开始执行时访问数据 cache, 返回执行周期数:
+ *     块正在由 MSHR 取回, 合并到该 MSHR, 等到块取回为止;
+ *     L1 命中, 为 L1 的周期数;
+ *     L1 缺失, 分配一个 MSHR, 加上从 L2 或内存取块的周期数, 没有空闲的 MSHR 时返回 -1.
+ * store 写不分配时缺失也不取块, 数据经写缓冲写到下一级, 与命中一样快.
+ * 块在缺失时立即装入 L1, 之后的访问由 MSHR 发现它还没有取回.
+ * store 只在这里取得块, 提交时才把块标记为脏, 见 cacheStore.
+ */
+int cacheAccess(machineState *statePtr, unsigned int address, int write) {
+  machineConfig *cfg = statePtr->config;
+  unsigned int block = address / cfg->lineSize[L1];
+  mshrEntry *free = NULL;
+  for (int i = 0; i < cfg->mshrs; i++) {
+    mshrEntry *m = &(statePtr->mshr[i]);
+    if (m->ready <= statePtr->cycles) {
+      free = m;
+    } else if (m->block == block) {
+      statePtr->stats.cacheMisses[L1]++;
+      statePtr->stats.mshrMerges++;
+      cacheLookup(statePtr, L1, block);
+      int wait = m->ready - statePtr->cycles;
+      return (wait > cfg->cacheLat[L1]) ? wait : cfg->cacheLat[L1];
+    }
+  }
+  if (cacheLookup(statePtr, L1, block) != NULL) {
+    statePtr->stats.cacheHits[L1]++;
+    return cfg->cacheLat[L1];
+  }
+  if (write && !cfg->writeAlloc) {
+    statePtr->stats.cacheMisses[L1]++;
+    return cfg->cacheLat[L1];
+  }
+  if (free == NULL) {
+    statePtr->stats.mshrStalls++;
+    return -1;
+  }
+  statePtr->stats.cacheMisses[L1]++;
+  int latency = cfg->cacheLat[L1] + missLatency(statePtr, address);
+  cacheFill(statePtr, L1, block, 0);
+  free->block = block;
+  free->ready = statePtr->cycles + latency;
+  return latency;
+}
+
+/*
+ * store 提交时写数据: 写回策略下 L1 中有该块则标记为脏,
+ * 写直达或块不在 L1 中时写到下一级
+ */
+void cacheStore(machineState *statePtr, unsigned int address) {
+  machineConfig *cfg = statePtr->config;
+  unsigned int block = address / cfg->lineSize[L1];
+  cacheLine *line = cacheLookup(statePtr, L1, block);
+  if (line != NULL && cfg->writeBack) {
+    line->dirty = 1;
+    return;
+  }
+  statePtr->stats.writeThroughs++;
+  writeNext(statePtr, L1, block);
+}
+
+/*
+ * 2 bit 饱和计数器, >= 2 预测跳转
+ */
+void counterUpdate(unsigned char *ctr, int taken) {
+  if (taken == TAKEN && *ctr < 3) {
+    (*ctr)++;
+  } else if (taken == NOTTAKEN && *ctr > 0) {
+    (*ctr)--;
+  }
+}
+
+/*
+ * 预测器的表按 PC 和全局历史的索引
+ */
+int localIndex(machineState *statePtr, int pc) {
+  return pc & ((1 << statePtr->config->phtBits) - 1);
+}
+
+int globalIndex(machineState *statePtr, int pc, unsigned long long hist) {
+  machineConfig *cfg = statePtr->config;
+  if (cfg->histBits < 64) {
+    hist &= (1ULL << cfg->histBits) - 1;
+  }
+  return (pc ^ hist ^ (hist >> cfg->phtBits)) & ((1 << cfg->phtBits) - 1);
+}
+
+/*
+ * bimodal: 使用 BTB 项中的 2 bit 状态.
+ * 由预测不跳转转为预测跳转时记下跳转目标.
+ */
+int bimodalPredict(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry) {
+  return (entry->branchPred == STRONGTAKEN || entry->branchPred == WEAKTAKEN) ? TAKEN : NOTTAKEN;
+}
+
+void bimodalUpdate(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry, int taken, int target) {
+  if (entry == NULL) {
+    return;
+  }
+  if (taken == TAKEN) {
+    switch (entry->branchPred) {
+      case STRONGNOT:
+        entry->branchPred = WEAKNOT;
+        break;
+      case WEAKNOT:
+        entry->branchPred = WEAKTAKEN;
+        entry->branchTarget = target;
+        break;
+      default:
+        entry->branchPred = STRONGTAKEN;
+        break;
+    }
+  } else {
+    switch (entry->branchPred) {
+      case WEAKTAKEN:
+        entry->branchPred = WEAKNOT;
+        break;
+      case STRONGTAKEN:
+        entry->branchPred = WEAKTAKEN;
+        break;
+      default:
+        entry->branchPred = STRONGNOT;
+        break;
+    }
+  }
+}
+
+/*
+ * gshare: PC 与全局历史异或后索引 2 bit 计数器表
+ */
+int gsharePredict(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry) {
+  return statePtr->pht[globalIndex(statePtr, pc, hist)] >= 2 ? TAKEN : NOTTAKEN;
+}
+
+void gshareUpdate(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry, int taken, int target) {
+  counterUpdate(&(statePtr->pht[globalIndex(statePtr, pc, hist)]), taken);
+  if (entry != NULL && taken == TAKEN) {
+    entry->branchTarget = target;
+  }
+}
+
+/*
+ * tournament: 每个 PC 一个选择计数器, >= 2 时采用 gshare, 否则采用按 PC 索引的计数器
+ */
+int tournamentPredict(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry) {
+  unsigned char *ctr = (statePtr->choice[localIndex(statePtr, pc)] >= 2)
+      ? &(statePtr->pht[globalIndex(statePtr, pc, hist)])
+      : &(statePtr->bimodal[localIndex(statePtr, pc)]);
+  return *ctr >= 2 ? TAKEN : NOTTAKEN;
+}
+
+void tournamentUpdate(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry, int taken, int target) {
+  unsigned char *local = &(statePtr->bimodal[localIndex(statePtr, pc)]);
+  unsigned char *global = &(statePtr->pht[globalIndex(statePtr, pc, hist)]);
+  int localRight = (*local >= 2) == (taken == TAKEN);
+  int globalRight = (*global >= 2) == (taken == TAKEN);
+  if (localRight != globalRight) {
+    counterUpdate(&(statePtr->choice[localIndex(statePtr, pc)]), globalRight ? TAKEN : NOTTAKEN);
+  }
+  counterUpdate(local, taken);
+  counterUpdate(global, taken);
+  if (entry != NULL && taken == TAKEN) {
+    entry->branchTarget = target;
+  }
+}
+
+/*
+ * TAGE: 按 PC 索引的基础表, 加上 NUMTAGE 张使用不同历史长度, 带 8 bit 标签的表.
+ * 命中的历史最长的表提供预测; 预测错误时在更长的表中分配一项.
+ */
+unsigned int foldHistory(unsigned long long hist, int len, int bits) {
+  if (len < 64) {
+    hist &= (1ULL << len) - 1;
+  }
+  unsigned int folded = 0;
+  while (hist != 0) {
+    folded ^= hist & ((1u << bits) - 1);
+    hist >>= bits;
+  }
+  return folded;
+}
+
+tageEntry *tageSlot(machineState *statePtr, int t, int pc, unsigned long long hist) {
+  int bits = statePtr->config->phtBits;
+  int index = (pc ^ (pc >> bits) ^ foldHistory(hist, tageHistLen[t], bits)) & ((1 << bits) - 1);
+  return &(statePtr->tage[(t << bits) + index]);
+}
+
+int tageTag(int t, int pc, unsigned long long hist) {
+  // 标签 0 留给空表项
+  return (pc ^ foldHistory(hist, tageHistLen[t], 8) ^ (foldHistory(hist, tageHistLen[t], 7) << 1)) % 255 + 1;
+}
+
+/*
+ * 返回提供预测的表, -1 表示基础表
+ */
+int tageProvider(machineState *statePtr, int pc, unsigned long long hist) {
+  for (int t = NUMTAGE - 1; t >= 0; t--) {
+    if (tageSlot(statePtr, t, pc, hist)->tag == tageTag(t, pc, hist)) {
+      return t;
+    }
+  }
+  return -1;
+}
+
+int tagePredict(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry) {
+  int t = tageProvider(statePtr, pc, hist);
+  if (t == -1) {
+    return statePtr->bimodal[localIndex(statePtr, pc)] >= 2 ? TAKEN : NOTTAKEN;
+  }
+  return tageSlot(statePtr, t, pc, hist)->ctr >= 0 ? TAKEN : NOTTAKEN;
+}
+
+void tageUpdate(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry, int taken, int target) {
+  int t = tageProvider(statePtr, pc, hist);
+  int predicted = tagePredict(statePtr, pc, hist, entry);
+  if (t == -1) {
+    counterUpdate(&(statePtr->bimodal[localIndex(statePtr, pc)]), taken);
+  } else {
+    tageEntry *e = tageSlot(statePtr, t, pc, hist);
+    if (taken == TAKEN && e->ctr < 3) {
+      e->ctr++;
+    } else if (taken == NOTTAKEN && e->ctr > -4) {
+      e->ctr--;
+    }
+    if (predicted == taken && e->useful < 3) {
+      e->useful++;
+    } else if (predicted != taken && e->useful > 0) {
+      e->useful--;
+    }
+  }
+  if (predicted != taken) {
+    int allocated = 0;
+    for (int u = t + 1; u < NUMTAGE && !allocated; u++) {
+      tageEntry *e = tageSlot(statePtr, u, pc, hist);
+      if (e->useful == 0) {
+        e->tag = tageTag(u, pc, hist);
+        e->ctr = (taken == TAKEN) ? 0 : -1;
+        allocated = 1;
+      }
+    }
+    // 没有可以替换的项, 降低更长的表中对应项的有用计数
+    for (int u = t + 1; u < NUMTAGE && !allocated; u++) {
+      tageEntry *e = tageSlot(statePtr, u, pc, hist);
+      if (e->useful > 0) {
+        e->useful--;
+      }
+    }
+  }
+  if (entry != NULL && taken == TAKEN) {
+    entry->branchTarget = target;
+  }
+}
+
+/*
+ * 分支预测器接口: 发射时在 BTB 命中后预测方向, 提交时用实际结果更新.
+ * hist 是这条分支发射时的全局历史.
+ */
+typedef struct _predictorOps {
+  int (*predict)(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry);
+  void (*update)(machineState *statePtr, int pc, unsigned long long hist, btbEntry *entry, int taken, int target);
+} predictorOps;
+
+predictorOps predictors[NUMPREDICTORS] = {
+  [PRED_BIMODAL]    = {bimodalPredict, bimodalUpdate},
+  [PRED_GSHARE]     = {gsharePredict, gshareUpdate},
+  [PRED_TOURNAMENT] = {tournamentPredict, tournamentUpdate},
+  [PRED_TAGE]       = {tagePredict, tageUpdate},
+};
+
+/*
+ * 配置文件和 -p 选项中可以使用的参数名
+ */
+typedef struct _configKey {
+  char *name;
+  size_t offset;  // 在 machineConfig 中的位置
+  int min;        // 允许的最小值
+  int max;        // 允许的最大值, 0 表示不限制
+  char **names;   // 取值也可以写成名称, 按取值索引
+} configKey;
+
+configKey configKeys[] = {
+  {"rbsize",      offsetof(machineConfig, rbSize),              1},
+  {"btbsize",     offsetof(machineConfig, btbSize),             1},
+  {"btbways",     offsetof(machineConfig, btbWays),             1},
+  {"memsize",     offsetof(machineConfig, memSize),             0},
+  {"loadunits",   offsetof(machineConfig, units[UNIT_LOAD]),    1},
+  {"storeunits",  offsetof(machineConfig, units[UNIT_STORE]),   1},
+  {"intunits",    offsetof(machineConfig, units[UNIT_INT]),     1},
+  {"branchunits", offsetof(machineConfig, units[UNIT_BRANCH]),  0},
+  {"mulunits",    offsetof(machineConfig, units[UNIT_MUL]),     0},
+  {"alus",        offsetof(machineConfig, fus[FU_ALU]),         0},
+  {"brus",        offsetof(machineConfig, fus[FU_BRANCH]),      0},
+  {"agus",        offsetof(machineConfig, fus[FU_AGU]),         0},
+  {"muls",        offsetof(machineConfig, fus[FU_MUL]),         0},
+  {"divs",        offsetof(machineConfig, fus[FU_DIV]),         0},
+  {"aluii",       offsetof(machineConfig, fuII[FU_ALU]),        0},
+  {"bruii",       offsetof(machineConfig, fuII[FU_BRANCH]),     0},
+  {"aguii",       offsetof(machineConfig, fuII[FU_AGU]),        0},
+  {"mulii",       offsetof(machineConfig, fuII[FU_MUL]),        0},
+  {"divii",       offsetof(machineConfig, fuII[FU_DIV]),        0},
+  {"branchexec",  offsetof(machineConfig, latency[LAT_BRANCH]), 1},
+  {"ldexec",      offsetof(machineConfig, latency[LAT_LOAD]),   1},
+  {"stexec",      offsetof(machineConfig, latency[LAT_STORE]),  1},
+  {"intexec",     offsetof(machineConfig, latency[LAT_INT]),    1},
+  {"mulexec",     offsetof(machineConfig, latency[LAT_MUL]),    1},
+  {"divexec",     offsetof(machineConfig, latency[LAT_DIV]),    1},
+  {"issuewidth",  offsetof(machineConfig, issueWidth),          1},
+  {"commitwidth", offsetof(machineConfig, commitWidth),         1},
+  {"memspec",     offsetof(machineConfig, memSpec),             0},
+  {"earlyresolve", offsetof(machineConfig, earlyResolve),       0, 1},
+  {"jumpatissue", offsetof(machineConfig, jumpAtIssue),        0, 1},
+  {"cdbs",        offsetof(machineConfig, cdbs),               0},
+  {"predictor",   offsetof(machineConfig, predictor),           0, NUMPREDICTORS - 1, predictorName},
+  {"phtbits",     offsetof(machineConfig, phtBits),             1, 24},
+  {"histbits",    offsetof(machineConfig, histBits),            0, 64},
+  {"l1size",      offsetof(machineConfig, cacheSize[L1]),       0},
+  {"l1ways",      offsetof(machineConfig, cacheWays[L1]),       1},
+  {"l1line",      offsetof(machineConfig, lineSize[L1]),        1},
+  {"l1lat",       offsetof(machineConfig, cacheLat[L1]),        1},
+  {"l2size",      offsetof(machineConfig, cacheSize[L2]),       0},
+  {"l2ways",      offsetof(machineConfig, cacheWays[L2]),       1},
+  {"l2line",      offsetof(machineConfig, lineSize[L2]),        1},
+  {"l2lat",       offsetof(machineConfig, cacheLat[L2]),        1},
+  {"memlat",      offsetof(machineConfig, memLat),              1},
+  {"writeback",   offsetof(machineConfig, writeBack),           0, 1},
+  {"writealloc",  offsetof(machineConfig, writeAlloc),          0, 1},
+  {"mshrs",       offsetof(machineConfig, mshrs),               1},
+  {"l1isize",     offsetof(machineConfig, cacheSize[L1I]),      0},
+  {"l1iways",     offsetof(machineConfig, cacheWays[L1I]),      1},
+  {"l1iline",     offsetof(machineConfig, lineSize[L1I]),       1},
+  {"fetchqueue",  offsetof(machineConfig, fetchQueue),          0},
+  {"fetchwidth",  offsetof(machineConfig, fetchWidth),          1},
+  {"physregs",    offsetof(machineConfig, physRegs),            0},
+  {"maxcycles",   offsetof(machineConfig, maxCycles),           0},
+};
+#define NUMCONFIGKEYS (sizeof(configKeys) / sizeof(configKeys[0]))
+
+/*
+ * 缺省的机器参数
+ */
+void defaultConfig(machineConfig *cfg) {
+  memset(cfg, 0, sizeof(machineConfig));
+  cfg->rbSize = RBSIZE;
+  cfg->btbSize = BTBSIZE;
+  cfg->btbWays = BTBWAYS;
+  cfg->memSize = MEMSIZE;
+  cfg->units[UNIT_LOAD] = NUMLOADUNITS;
+  cfg->units[UNIT_STORE] = NUMSTOREUNITS;
+  cfg->units[UNIT_INT] = NUMINTUNITS;
+  cfg->units[UNIT_BRANCH] = NUMBRANCHUNITS;
+  cfg->units[UNIT_MUL] = NUMMULUNITS;
+  cfg->latency[LAT_BRANCH] = BRANCHEXEC;
+  cfg->latency[LAT_LOAD] = LDEXEC;
+  cfg->latency[LAT_STORE] = STEXEC;
+  cfg->latency[LAT_INT] = INTEXEC;
+  cfg->latency[LAT_MUL] = MULEXEC;
+  cfg->latency[LAT_DIV] = DIVEXEC;
+  cfg->issueWidth = ISSUEWIDTH;
+  cfg->commitWidth = COMMITWIDTH;
+  cfg->memSpec = MEMSPEC;
+  cfg->earlyResolve = EARLYRESOLVE;
+  cfg->jumpAtIssue = JUMPATISSUE;
+  cfg->cdbs = CDBS;
+  cfg->predictor = PREDICTOR;
+  cfg->phtBits = PHTBITS;
+  cfg->histBits = HISTBITS;
+  cfg->cacheSize[L1] = L1SIZE;
+  cfg->cacheWays[L1] = L1WAYS;
+  cfg->lineSize[L1] = L1LINE;
+  cfg->cacheLat[L1] = L1LAT;
+  cfg->cacheSize[L2] = L2SIZE;
+  cfg->cacheWays[L2] = L2WAYS;
+  cfg->lineSize[L2] = L2LINE;
+  cfg->cacheLat[L2] = L2LAT;
+  cfg->memLat = MEMLAT;
+  cfg->writeBack = WRITEBACK;
+  cfg->writeAlloc = WRITEALLOC;
+  cfg->mshrs = MSHRS;
+  cfg->cacheSize[L1I] = L1ISIZE;
+  cfg->cacheWays[L1I] = L1IWAYS;
+  cfg->lineSize[L1I] = L1ILINE;
+  cfg->fetchQueue = FETCHQUEUE;
+  cfg->fetchWidth = FETCHWIDTH;
+  cfg->physRegs = PHYSREGS;
+}
+
+/*
+ * 设置一个参数, 参数名不存在或取值不合法时返回 -1
+ */
+int setConfig(machineConfig *cfg, char *key, char *value) {
+  for (int i = 0; i < NUMCONFIGKEYS; i++) {
+    if (strcmp(key, configKeys[i].name) == 0) {
+      char *end;
+      long v = strtol(value, &end, 0);
+      if (configKeys[i].names != NULL) {
+        for (int k = 0; configKeys[i].names[k] != NULL; k++) {
+          if (strcmp(value, configKeys[i].names[k]) == 0) {
+            v = k;
+            end = value + strlen(value);
+          }
+        }
+      }
+      if (end == value || *end != '\0' || v < configKeys[i].min ||
+          (configKeys[i].max > 0 && v > configKeys[i].max)) {
+        return -1;
+      }
+      *(int *) ((char *) cfg + configKeys[i].offset) = v;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * 解析一行 "key = value", 忽略空行和 # 之后的注释
+ */
+int parseConfigLine(machineConfig *cfg, char *text) {
+  char line[MAXLINELENGTH], key[MAXLINELENGTH], value[MAXLINELENGTH];
+  strncpy(line, text, MAXLINELENGTH - 1);
+  line[MAXLINELENGTH - 1] = '\0';
+  char *comment = strchr(line, '#');
+  if (comment != NULL) {
+    *comment = '\0';
+  }
+  for (char *c = line; *c; c++) {
+    if (*c == '=') {
+      *c = ' ';
+    }
+  }
+  int n = sscanf(line, "%s %s", key, value);
+  if (n <= 0) {
+    return 0;
+  }
+  return (n == 2) ? setConfig(cfg, key, value) : -1;
+}
+
+/*
+ * 读取配置文件
+ */
+void readConfig(machineConfig *cfg, char *path) {
+  char line[MAXLINELENGTH];
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("error: can't open file %s", path);
+    perror("fopen");
+    exit(1);
+  }
+  for (int lineNum = 1; fgets(line, MAXLINELENGTH, fp) != NULL; lineNum++) {
+    if (parseConfigLine(cfg, line) != 0) {
+      printf("error: %s:%d: bad config line\n", path, lineNum);
+      exit(1);
+    }
+  }
+  fclose(fp);
+}
+
+/*
+ * 根据各类保留站的数量生成保留站名称和类别表
+ */
+void finishConfig(machineConfig *cfg) {
+  if (cfg->btbWays > cfg->btbSize) {  // 全相联
+    cfg->btbWays = cfg->btbSize;
+  }
+  if (cfg->cacheSize[L1] == 0) {  // 没有 L1 时也不模拟 L2
+    cfg->cacheSize[L2] = 0;
+  }
+  if (cfg->fetchQueue == 0) {  // 没有取指阶段时也不模拟指令 cache
+    cfg->cacheSize[L1I] = 0;
+  }
+  for (int k = 0; k < NUMCACHES; k++) {
+    int lines = cfg->cacheSize[k] / cfg->lineSize[k];
+    if (lines > 0 && cfg->cacheWays[k] > lines) {  // 全相联
+      cfg->cacheWays[k] = lines;
+    }
+  }
+  cfg->numUnits = 0;
+  for (int c = 0; c < NUMCLASSES; c++) {
+    cfg->numUnits += cfg->units[c];
+  }
+  cfg->numFUs = 0;
+  for (int k = 0; k < NUMFUCLASSES; k++) {
+    cfg->fuBase[k] = cfg->numFUs;
+    cfg->numFUs += cfg->fus[k];
+  }
+  cfg->unitname = (char **) malloc(cfg->numUnits * sizeof(char *));
+  cfg->unitclass = (int *) malloc(cfg->numUnits * sizeof(int));
+  int unit = 0;
+  for (int c = 0; c < NUMCLASSES; c++) {
+    for (int i = 1; i <= cfg->units[c]; i++) {
+      cfg->unitname[unit] = (char *) malloc(strlen(classname[c]) + 12);
+      sprintf(cfg->unitname[unit], "%s%d", classname[c], i);
+      cfg->unitclass[unit] = c;
+      unit++;
+    }
+  }
+}
+
+/*
+ * 检查参数之间的约束, 不满足时返回错误信息, 否则返回 NULL
+ */
+char *configError(machineConfig *cfg) {
+  if (cfg->btbSize > cfg->btbWays && cfg->btbSize % cfg->btbWays != 0) {
+    return "btbsize must be a multiple of btbways";
+  }
+  if (cfg->physRegs > 0 && cfg->physRegs <= NUMREGS) {
+    return "physregs must be 0 or more than the number of registers";
+  }
+  for (int k = 0; k < NUMCACHES; k++) {
+    int lines = cfg->cacheSize[k] / cfg->lineSize[k];
+    if (cfg->cacheSize[k] % cfg->lineSize[k] != 0) {
+      return "cache size must be a multiple of the line size";
+    }
+    if (lines > cfg->cacheWays[k] && lines % cfg->cacheWays[k] != 0) {
+      return "cache lines must be a multiple of the cache ways";
+    }
+  }
+  return NULL;
+}
+
+/*
+ * 机器状态占用的内存大小. 保留站, ROB, BTB 和预测器的表与 machineState 放在同一块内存中,
+ * 运行期间不再分配. 内存按页另外分配. 大小取整到 8 字节, 检查点按 4 字节的字压缩.
+ */
+size_t machineSize(machineConfig *cfg) {
+  size_t tableSize = (size_t) 1 << cfg->phtBits;
+  size_t size = sizeof(machineState) + cfg->numUnits * sizeof(resStation) +
+                cfg->rbSize * sizeof(reorderEntry) + cfg->btbSize * sizeof(btbEntry) +
+                cfg->rbSize * NUMREGS * sizeof(regResultEntry) +
+                (cfg->rbSize + 2 * cfg->numUnits) * sizeof(int) + NUMTAGE * tableSize * sizeof(tageEntry) + 3 * tableSize +
+                cfg->mshrs * sizeof(mshrEntry) +
+                cfg->fetchQueue * sizeof(fetchEntry) + (cfg->numUnits + cfg->rbSize + 1) * sizeof(long long) +
+                (cfg->numFUs + 4 * cfg->physRegs) * sizeof(int);
+  for (int k = 0; k < NUMCACHES; k++) {
+    size += cfg->cacheSize[k] / cfg->lineSize[k] * sizeof(cacheLine);
+  }
+  return (size + 7) & ~(size_t) 7;
+}
+
+/*
+ * 按参数设置机器状态中指向各个表的指针. 新建, 复制和恢复机器状态之后调用.
+ */
+void layoutMachine(machineState *statePtr) {
+  machineConfig *cfg = statePtr->config;
+  size_t tableSize = (size_t) 1 << cfg->phtBits;
+  char *block = (char *) statePtr + sizeof(machineState);
+  statePtr->reservation = (resStation *) block;
+  block += cfg->numUnits * sizeof(resStation);
+  statePtr->reorderBuf = (reorderEntry *) block;
+  block += cfg->rbSize * sizeof(reorderEntry);
+  statePtr->btBuf = (btbEntry *) block;
+  block += cfg->btbSize * sizeof(btbEntry);
+  for (int k = 0; k < NUMCACHES; k++) {
+    statePtr->cache[k] = (cacheLine *) block;
+    block += cfg->cacheSize[k] / cfg->lineSize[k] * sizeof(cacheLine);
+  }
+  statePtr->fetchQueue = (fetchEntry *) block;
+  block += cfg->fetchQueue * sizeof(fetchEntry);
+  statePtr->unitBusy = (long long *) block;
+  block += cfg->numUnits * sizeof(long long);
+  statePtr->robHist = (long long *) block;
+  block += (cfg->rbSize + 1) * sizeof(long long);
+  statePtr->checkpoints = (regResultEntry *) block;
+  block += cfg->rbSize * NUMREGS * sizeof(regResultEntry);
+  statePtr->consumerHead = (int *) block;
+  block += cfg->rbSize * sizeof(int);
+  statePtr->consumerNext = (int *) block;
+  block += 2 * cfg->numUnits * sizeof(int);
+  statePtr->mshr = (mshrEntry *) block;
+  block += cfg->mshrs * sizeof(mshrEntry);
+  statePtr->fuFree = (int *) block;
+  block += cfg->numFUs * sizeof(int);
+  statePtr->physFile = (int *) block;
+  block += cfg->physRegs * sizeof(int);
+  statePtr->physReady = (int *) block;
+  block += cfg->physRegs * sizeof(int);
+  statePtr->freeList = (int *) block;
+  block += cfg->physRegs * sizeof(int);
+  statePtr->physMark = (int *) block;
+  block += cfg->physRegs * sizeof(int);
+  // 预测器的表都是字节数组, 放在最后
+  statePtr->tage = (tageEntry *) block;
+  block += NUMTAGE * tableSize * sizeof(tageEntry);
+  statePtr->bimodal = (unsigned char *) block;
+  block += tableSize;
+  statePtr->pht = (unsigned char *) block;
+  block += tableSize;
+  statePtr->choice = (unsigned char *) block;
+}
+
+/*
+ * 分配机器状态, 所有表都是 0
+ */
+machineState *newMachine(machineConfig *cfg) {
+  size_t size = machineSize(cfg);
+  machineState *statePtr = (machineState *) calloc(1, size);
+  if (statePtr == NULL) {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  statePtr->config = cfg;
+  statePtr->blockSize = size;
+  statePtr->memory = (pageTable *) calloc(1, sizeof(pageTable));
+  if (statePtr->memory == NULL) {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  layoutMachine(statePtr);
+  return statePtr;
+}
+
+void freeMachine(machineState *statePtr) {
+  clearPages(statePtr->memory);
+  free(statePtr->memory->dirty);
+  free(statePtr->memory);
+  free(statePtr);
+}
+
+/*
+ * 把 src 的全部状态复制到 dst, 两者必须由同一组参数创建. 内存只复制写过的页.
+ */
+void copyMachine(machineState *dst, machineState *src) {
+  pageTable *memory = dst->memory;
+  memcpy(dst, src, src->blockSize);
+  dst->memory = memory;
+  layoutMachine(dst);
+  copyPages(memory, src->memory);
+}
+
+/*
+ * 检查点只能恢复到用相同参数和程序创建的机器中, 所以参数和程序大小都写在文件头中, 恢复时比较.
+ * 参数中周期数上限可以不同, 比较时不算在内.
+ */
+void ckptConfig(machineConfig *cfg, machineConfig *key) {
+  memcpy(key, cfg, sizeof(machineConfig));
+  key->maxCycles = 0;
+}
+
+/*
+ * 输出检查点文件头
+ */
+void beginCheckpoints(FILE *fp, machineState *statePtr, int memorySize) {
+  machineConfig key;
+  ckptConfig(statePtr->config, &key);
+  fwrite(CKPT_MAGIC, 1, 4, fp);
+  putLittle(fp, CKPT_VERSION, 4);
+  putLittle(fp, statePtr->blockSize, 8);
+  putLittle(fp, memorySize, 4);
+  putLittle(fp, offsetof(machineConfig, numUnits), 4);
+  fwrite(&key, 1, offsetof(machineConfig, numUnits), fp);
+}
+
+/*
+ * 压缩写出 n 个字
+ */
+void putWords(FILE *fp, unsigned int *words, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    size_t zeros = 0, literals = 0;
+    while (i + zeros < n && words[i + zeros] == 0) {
+      zeros++;
+    }
+    while (i + zeros + literals < n && words[i + zeros + literals] != 0) {
+      literals++;
+    }
+    putLittle(fp, zeros, 4);
+    putLittle(fp, literals, 4);
+    fwrite(&words[i + zeros], 4, literals, fp);
+    i += zeros + literals;
+  }
+}
+
+/*
+ * 在检查点文件末尾追加一条当前状态的记录. 数据长度先写 0, 写完数据后回填.
+ */
+void writeCheckpoint(FILE *fp, machineState *statePtr) {
+  pageTable *mem = statePtr->memory;
+  fputc(CKPT_RECORD, fp);
+  putLittle(fp, statePtr->cycles, 4);
+  long lengthPos = ftell(fp);
+  putLittle(fp, 0, 8);
+  putWords(fp, (unsigned int *) statePtr, statePtr->blockSize / 4);
+  putLittle(fp, mem->numDirty, 4);
+  for (int i = 0; i < mem->numDirty; i++) {
+    putLittle(fp, mem->dirty[i]->number, 4);
+    putWords(fp, (unsigned int *) mem->dirty[i]->data, PAGEWORDS);
+  }
+  long end = ftell(fp);
+  fseek(fp, lengthPos, SEEK_SET);
+  putLittle(fp, end - lengthPos - 8, 8);
+  fseek(fp, end, SEEK_SET);
+}
+
+/*
+ * 每个周期开始时检查是否到了写检查点的周期
+ */
+void traceCheckpoint(traceWriter *tw, machineState *statePtr) {
+  if (tw->ckptFp != NULL && statePtr->cycles >= tw->ckptNext) {
+    writeCheckpoint(tw->ckptFp, statePtr);
+    tw->ckptNext = statePtr->cycles - statePtr->cycles % tw->ckptInterval + tw->ckptInterval;
+  }
+}
+
+/*
+ * 取 PC 处的一条指令放入 fe, 并把 PC 改为预测的下一条指令:
+ * 条件分支查 BTB 和预测器, 按预测更新全局历史; JR 按 BTB 中上次的目标预测;
+ * jumpatissue 时 J 和 JAL 直接跳到目标.
+ * 没有取指阶段时在发射时调用, 否则在取指阶段调用.
+ */
+void fetchInstr(machineState *statePtr, fetchEntry *fe) {
+  machineConfig *cfg = statePtr->config;
+  decodedInstr tmp;
+  decodedInstr *d = fetchDecoded(statePtr, statePtr->pc, &tmp);
+  fe->dec = *d;
+  fe->pc = statePtr->pc;
+  fe->predHist = statePtr->ghr;
+  if (isBranch(d->op)) {
+    btbEntry *entry = btbAccess(statePtr, statePtr->pc);
+    int taken = NOTTAKEN;  // BTB 中没有对应的项目时不能预测, 按不跳转处理
+    if (entry != NULL) {
+      taken = predictors[cfg->predictor].predict(statePtr, statePtr->pc, statePtr->ghr, entry);
+    }
+    statePtr->ghr = (statePtr->ghr << 1) | taken;
+    statePtr->pc = (taken == TAKEN) ? entry->branchTarget : statePtr->pc + 1;
+  } else if (d->op == JR) {
+    btbEntry *entry = btbAccess(statePtr, statePtr->pc);
+    statePtr->pc = (entry != NULL) ? entry->branchTarget : statePtr->pc + 1;
+  } else if (jumpsAtIssue(cfg, d)) {
+    statePtr->pc = statePtr->pc + 1 + d->imm;
+  } else {
+    statePtr->pc++;
+  }
+  fe->predPC = statePtr->pc;
+}
+
+/*
+ * 取指阶段: 沿预测的路径最多取 fetchWidth 条指令放入取指队列,
+ * 预测跳转之后的指令留到下个周期从目标处取. 有指令 cache 时每周期只从一个块中取指,
+ * 缺失时从下一级取块, 取回之前不能取指.
+ */
+void fetchStage(machineState *statePtr, int memorySize) {
+  machineConfig *cfg = statePtr->config;
+  if (statePtr->pc >= memorySize) {
+    return;
+  }
+  if (statePtr->fetchReady > statePtr->cycles) {
+    statePtr->stats.icacheStalls++;
+    return;
+  }
+  if (statePtr->fqCount == cfg->fetchQueue) {
+    statePtr->stats.fetchQueueFull++;
+    return;
+  }
+  unsigned int block = 0;
+  if (cfg->cacheSize[L1I] > 0) {
+    block = statePtr->pc / cfg->lineSize[L1I];
+    if (cacheLookup(statePtr, L1I, block) == NULL) {
+      statePtr->stats.cacheMisses[L1I]++;
+      cacheFill(statePtr, L1I, block, 0);
+      statePtr->fetchReady = statePtr->cycles + missLatency(statePtr, statePtr->pc);
+      statePtr->stats.icacheStalls++;
+      return;
+    }
+    statePtr->stats.cacheHits[L1I]++;
+  }
+  for (int w = 0; w < cfg->fetchWidth && statePtr->fqCount < cfg->fetchQueue && statePtr->pc < memorySize; w++) {
+    if (cfg->cacheSize[L1I] > 0 && statePtr->pc / cfg->lineSize[L1I] != block) {
+      break;
+    }
+    fetchEntry *fe = &(statePtr->fetchQueue[(statePtr->fqHead + statePtr->fqCount) % cfg->fetchQueue]);
+    fetchInstr(statePtr, fe);
+    statePtr->fqCount++;
+    if (fe->predPC != fe->pc + 1) {
+      break;
+    }
+  }
+}
+
+/*
+ * 下一条要发射的指令: 没有取指阶段时是内存中 PC 处的指令, 否则是取指队列的队首.
+ * 没有指令可以发射时返回 NULL
+ */
+decodedInstr *nextIssue(machineState *statePtr, int memorySize, decodedInstr *tmp) {
+  machineConfig *cfg = statePtr->config;
+  if (cfg->fetchQueue > 0) {
+    return (statePtr->fqCount > 0) ? &(statePtr->fetchQueue[statePtr->fqHead].dec) : NULL;
+  }
+  return (statePtr->pc < memorySize) ? fetchDecoded(statePtr, statePtr->pc, tmp) : NULL;
+}
+
+/*
+ * 物理寄存器模式下指令 d 要写寄存器, 但没有空闲的物理寄存器
+ */
+int noPhysReg(machineState *statePtr, decodedInstr *d) {
+  return statePtr->config->physRegs > 0 && d->rd != -1 && statePtr->freeCount == 0;
+}
+
+/*
+ * 本周期没有发射指令的原因, 见 CYCLE_*
+ */
+int stallCause(machineState *statePtr, int RBNum, int memorySize) {
+  machineConfig *cfg = statePtr->config;
+  if (RBNum >= cfg->rbSize) {
+    return CYCLE_ROBFULL;
+  }
+  decodedInstr tmp;
+  decodedInstr *d = nextIssue(statePtr, memorySize, &tmp);
+  if (d == NULL) {
+    return CYCLE_FRONTEND;
+  }
+  if ((jumpsAtIssue(cfg, d) || freeUnit(statePtr, d->unitClass) != -1) && noPhysReg(statePtr, d)) {
+    return CYCLE_REGFULL;
+  }
+  int unitClass = stationClass(cfg, d->unitClass);
+  for (int u = 0; u < cfg->numUnits; u++) {
+    resStation *rs = &(statePtr->reservation[u]);
+    if (cfg->unitclass[u] == unitClass && rs->busy && (rs->Qj != -1 || rs->Qk != -1)) {
+      return CYCLE_OPERAND;
+    }
+  }
+  return CYCLE_RSFULL + unitClass;
+}
+
+/*
+ * 把 n 个周期记为 cause 类, 同时记录这些周期中 ROB 的占用和被占用的保留站
+ */
+void countCycles(machineState *statePtr, int cause, int RBNum, int n) {
+  machineConfig *cfg = statePtr->config;
+  statePtr->stats.cycleCauses[cause] += n;
+  statePtr->robHist[RBNum] += n;
+  for (int u = 0; u < cfg->numUnits; u++) {
+    if (statePtr->reservation[u].busy) {
+      statePtr->unitBusy[u] += n;
+    }
+  }
+}
+
+/*
+ * ROB 项 i 之后发射的指令已被清除: 此后记为 CYCLE_ISSUE 的周期发射的都是错误路径上的指令,
+ * 改记为 CYCLE_FLUSH. 如果没有留下 HALT, 此后记为 CYCLE_HALT 的周期等待的也是
+ * 错误路径上的 HALT, 同样改记.
+ */
+void chargeFlush(machineState *statePtr, int i) {
+  long long *causes = statePtr->stats.cycleCauses;
+  long long wasted = causes[CYCLE_ISSUE] - statePtr->reorderBuf[i].issueMark;
+  if (wasted > 0) {
+    causes[CYCLE_ISSUE] -= wasted;
+    causes[CYCLE_FLUSH] += wasted;
+  }
+  wasted = causes[CYCLE_HALT] - statePtr->reorderBuf[i].haltMark;
+  if (statePtr->haltsInFlight == 0 && wasted > 0) {
+    causes[CYCLE_HALT] -= wasted;
+    causes[CYCLE_FLUSH] += wasted;
+  }
+}
+
+/*
+ * 如果本周期不能提交, 不能发射, 也没有指令开始执行或写回, 只有执行中的指令在倒计时,
+ * 取指阶段也在等待指令 cache 或者无事可做, 返回从本周期开始这样的周期数,
+ * 即到下一条指令执行完成或恢复取指之前的周期数; 否则返回 0.
+ */
+int idleCycles(machineState *statePtr, int headRB, int tailRB, int memorySize) {
+  machineConfig *cfg = statePtr->config;
+  int RBNum = robCount(statePtr, headRB, tailRB);
+  // 能否提交
+  if (RBNum > 0 && statePtr->reorderBuf[headRB].instrStatus == COMMITTING) {
+    return 0;
+  }
+  // 能否发射
+  decodedInstr tmp;
+  decodedInstr *d = nextIssue(statePtr, memorySize, &tmp);
+  if (RBNum < cfg->rbSize && d != NULL) {
+    if ((jumpsAtIssue(cfg, d) || freeUnit(statePtr, d->unitClass) != -1) && !noPhysReg(statePtr, d)) {
+      return 0;
+    }
+  }
+  int idle = 0;
+  // 能否取指
+  if (cfg->fetchQueue > 0 && statePtr->pc < memorySize && statePtr->fqCount < cfg->fetchQueue) {
+    if (statePtr->fetchReady <= statePtr->cycles) {
+      return 0;
+    }
+    idle = statePtr->fetchReady - statePtr->cycles;
+  }
+  for (int n = 0, i = headRB; n < RBNum; n++, i = nextRB(cfg, i)) {
+    reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+    if (!RBPtr->busy || RBPtr->instrStatus == COMMITTING) {
+      continue;
+    }
+    resStation *rs = &(statePtr->reservation[RBPtr->execUnit]);
+    if (RBPtr->instrStatus == ISSUING && (rs->Qj != -1 || rs->Qk != -1)) {
+      continue;  // 操作数要等写回才能准备好
+    }
+    if (RBPtr->instrStatus != EXECUTING || rs->exTimeLeft <= 1) {
+      return 0;
+    }
+    if (idle == 0 || rs->exTimeLeft - 1 < idle) {
+      idle = rs->exTimeLeft - 1;
+    }
+  }
+  return idle;
+}
+
+/*
+ * 跳过 n 个空闲周期: 执行中的指令的剩余时间减少 n, 前端的停顿按每个周期计数
+ */
+void skipCycles(machineState *statePtr, int headRB, int tailRB, int n, int memorySize) {
+  machineConfig *cfg = statePtr->config;
+  int RBNum = robCount(statePtr, headRB, tailRB);
+  if (cfg->fetchQueue > 0) {
+    if (RBNum < cfg->rbSize && statePtr->fqCount == 0) {
+      statePtr->stats.fetchBubbles += n;
+    }
+    if (statePtr->pc < memorySize && statePtr->fetchReady > statePtr->cycles) {
+      statePtr->stats.icacheStalls += n;
+    } else if (statePtr->pc < memorySize && statePtr->fqCount == cfg->fetchQueue) {
+      statePtr->stats.fetchQueueFull += n;
+    }
+  }
+  for (int k = 0, i = headRB; k < RBNum; k++, i = nextRB(cfg, i)) {
+    if (statePtr->reorderBuf[i].busy && statePtr->reorderBuf[i].instrStatus == EXECUTING) {
+      statePtr->reservation[statePtr->reorderBuf[i].execUnit].exTimeLeft -= n;
+    }
+  }
+  countCycles(statePtr, statePtr->haltsInFlight > 0 ? CYCLE_HALT : stallCause(statePtr, RBNum, memorySize), RBNum, n);
+  statePtr->cycles += n;
+  statePtr->stats.skippedCycles += n;
+}
+
+/*
+ * 运行到 HALT 指令提交为止, 每个周期开始时输出状态.
+ * 返回 SIM_HALT; 如果配置了 maxcycles 且运行超过该周期数, 返回 SIM_LIMIT;
+ * 提交的 LW/SW 的地址超出地址空间时停在这条指令, 返回 SIM_FAULT.
+ */
+int simulate(machineState *statePtr, traceWriter *tw, int memorySize) {
+  machineConfig *cfg = statePtr->config;
+  // ROB 的队首和队尾在周期之间保存在机器状态中, 从检查点恢复后可以接着运行
+  int headRB = statePtr->headRB;
+  int tailRB = statePtr->tailRB;
+
+  if (statePtr->halted) {
+    return statePtr->fault ? SIM_FAULT : SIM_HALT;
+  }
+
+  /*
+   * 处理指令
+   */
+  while (1) {  /* 执行循环:你应该在执行 HALT 指令时跳出这个循环 */
+
+    // printState(statePtr, memorySize);
+
+    statePtr->headRB = headRB;
+    statePtr->tailRB = tailRB;
+    traceCycle(tw, statePtr, memorySize);
+    traceCheckpoint(tw, statePtr);
+    if (cfg->maxCycles > 0 && statePtr->cycles >= cfg->maxCycles) {
+      return SIM_LIMIT;
+    }
+
+    /*
+     * 空闲周期: 只有执行中的指令在倒计时, 直接跳到下一条指令执行完成的周期.
+     * 输出逐周期状态时每次只跳过一个周期, 每个周期的状态照常输出.
+     */
+    int idle = idleCycles(statePtr, headRB, tailRB, memorySize);
+    if (idle > 0) {
+      if (tw->format != TRACE_NONE) {
+        idle = 1;
+      }
+      if (cfg->maxCycles > 0 && idle > cfg->maxCycles - statePtr->cycles) {
+        idle = cfg->maxCycles - statePtr->cycles;
+      }
+      if (tw->ckptFp != NULL && idle > tw->ckptNext - statePtr->cycles) {  // 检查点在整数倍的周期上
+        idle = tw->ckptNext - statePtr->cycles;
+      }
+      skipCycles(statePtr, headRB, tailRB, idle, memorySize);
+      continue;
+    }
+
+    /*
+     * 基本要求:
+     * 首先, 确定是否需要清空流水线或提交位于 ROB 的队首的指令.
+     * 每个周期最多从队首连续提交 cfg->commitWidth 条已经完成的指令.
+     * 我们处理分支跳转的缺省方法是假设跳转不成功, 如果我们的预测是错误的,
+     * 就需要清空流水线(ROB/保留站/寄存器状态), 设置新的 PC = 跳转目标.
+     * 如果不需要清空, 并且队首指令能够提交, 在这里更新状态:
+     *     对寄存器访问, 修改寄存器;
+     *     对内存写操作, 修改内存.
+     * 在完成清空或提交操作后, 不要忘了释放保留站并更新队列的首指针.
+     */
+    int halted = 0;
+    int flushed = 0;  // 本周期清除了错误路径上的指令
+    for (int w = 0; w < cfg->commitWidth; w++) {
+      if (headRB == -1 || !statePtr->reorderBuf[headRB].busy || statePtr->reorderBuf[headRB].instrStatus != COMMITTING) {
+        break;
+      }
+      int committed = headRB;
+        decodedInstr *d = &(statePtr->reorderBuf[headRB].dec);
+        if (isBranch(d->op)) {
+          /*
+           * 选作内容:
+           * 在提交的时候, 我们知道跳转指令的最终结果.
+           * 发射时记下了预测的下一条指令的 PC (BTB 中没有对应的项目时按不跳转处理),
+           * 如果它与实际的下一条指令不同, 说明预测错误,
+           * 就必须将 PC 设置为正确的值, 恢复全局历史, 并清空流水线.
+           * 不论预测是否正确, 都需要用实际结果更新预测器.
+           */
+          reorderEntry *RBPtr = &(statePtr->reorderBuf[headRB]);
+          int taken = (RBPtr->branchCmp == 1) ? TAKEN : NOTTAKEN;
+          int nextPC = (taken == TAKEN) ? RBPtr->result : RBPtr->branchPC + 1;
+          statePtr->stats.branches++;
+          statePtr->stats.instructions++;
+          predictors[cfg->predictor].update(statePtr, RBPtr->branchPC, RBPtr->predHist,
+                                            btbLookup(statePtr, RBPtr->branchPC), taken, RBPtr->result);
+          if (RBPtr->resolved) {  // 已在执行完成时确定结果并恢复
+            if (RBPtr->mispredicted) {
+              statePtr->stats.mispredicts++;
+              statePtr->stats.flushes++;
+              statePtr->stats.penaltyCycles += RBPtr->resolveCycle - RBPtr->issueCycle;
+            }
+            // 释放保留站
+            RBPtr->busy = 0;
+            // 更新队列的首指针
+            headRB = nextRB(cfg, headRB);
+          } else if (nextPC != RBPtr->predPC) {  // 预测错误
+            statePtr->stats.mispredicts++;
+            statePtr->stats.flushes++;
+            statePtr->stats.penaltyCycles += statePtr->cycles - RBPtr->issueCycle;
+            // 设置跳转地址
+            redirectFetch(statePtr, nextPC);
+            statePtr->ghr = (RBPtr->predHist << 1) | taken;
+            flushPipeline(statePtr);
+            chargeFlush(statePtr, headRB);
+            flushed = 1;
+            // 更新队列的首指针
+            headRB = -1;
+            tailRB = -1;
+          } else {  // 预测正确
+            // 释放保留站
+            RBPtr->busy = 0;
+            // 更新队列的首指针
+            headRB = nextRB(cfg, headRB);
+          }
+        } else if (isJump(d->op)) {
+          /*
+           * 跳转在提交时修改 PC, 除非发射时已经预测到了目标 (jumpatissue, 或 JR 的 BTB 预测正确).
+           * JAL 在这里把返回地址写入 r31; JR 用实际目标更新 BTB, 下次取指时按它预测.
+           */
+          reorderEntry *RBPtr = &(statePtr->reorderBuf[headRB]);
+          int target = jumpTarget(RBPtr);
+          statePtr->stats.jumps++;
+          statePtr->stats.instructions++;
+          if (d->rd != -1) {
+            commitRegister(statePtr, headRB);
+          }
+          if (d->op == JR) {
+            btbEntry *entry = btbLookup(statePtr, RBPtr->pc);
+            if (entry != NULL) {
+              entry->branchTarget = target;
+            }
+          }
+          if (RBPtr->resolved) {  // 已在执行完成时跳转
+            if (RBPtr->mispredicted) {
+              statePtr->stats.flushes++;
+              statePtr->stats.penaltyCycles += RBPtr->resolveCycle - RBPtr->issueCycle;
+            }
+            // 释放保留站
+            RBPtr->busy = 0;
+            // 更新队列的首指针
+            headRB = nextRB(cfg, headRB);
+          } else if (d->op == JR && target == RBPtr->predPC) {  // 目标预测正确
+            // 释放保留站
+            RBPtr->busy = 0;
+            // 更新队列的首指针
+            headRB = nextRB(cfg, headRB);
+          } else {
+            statePtr->stats.flushes++;
+            statePtr->stats.penaltyCycles += statePtr->cycles - RBPtr->issueCycle;
+            // 设置跳转地址
+            redirectFetch(statePtr, target);
+            statePtr->ghr = RBPtr->predHist;
+            flushPipeline(statePtr);
+            chargeFlush(statePtr, headRB);
+            flushed = 1;
+            // 更新队列的首指针
+            headRB = -1;
+            tailRB = -1;
+          }
+        } else if (d->op == HALT) {
+          statePtr->stats.instructions++;
+          // 释放保留站, 更新队列的首指针
+          headRB = nextRB(cfg, headRB);
+          // 停机
+          halted = 1;
+        } else if (d->op == NOOP) {
+          statePtr->stats.instructions++;
+          // 释放保留站
+          statePtr->reorderBuf[headRB].busy = 0;
+          // 更新队列的首指针
+          headRB = nextRB(cfg, headRB);
+          // 不进行操作
+        } else if (memFault(statePtr, &(statePtr->reorderBuf[headRB]))) {
+          // 访存错误: 不提交这条指令, 机器停在这里
+          reorderEntry *RBPtr = &(statePtr->reorderBuf[headRB]);
+          statePtr->fault = 1;
+          statePtr->faultAddress = (d->op == LW) ? RBPtr->loadAddress : RBPtr->storeAddress;
+          statePtr->faultPC = RBPtr->pc;
+          halted = 1;
+        } else {
+          statePtr->stats.instructions++;
+          if (d->op == SW) {  // 修改内存
+            int storeAddress = statePtr->reorderBuf[headRB].storeAddress;
+            if (statePtr->reorderBuf[headRB].valid == 1) {
+              writeWord(statePtr, storeAddress, statePtr->reorderBuf[headRB].result);
+              if (cfg->cacheSize[L1] > 0) {
+                cacheStore(statePtr, storeAddress);
+              }
+            }
+          } else if (d->rd != -1) {  // 修改寄存器
+            commitRegister(statePtr, headRB);
+          }
+          // 释放保留站
+          statePtr->reorderBuf[headRB].busy = 0;
+          // 更新队列的首指针
+          headRB = nextRB(cfg, headRB);
+        }
+      // 停机, 清空了流水线, 或队首指令没有提交时, 本周期不再继续提交
+      if (halted || headRB == -1 || statePtr->reorderBuf[committed].busy) {
+        break;
+      }
+    }
+    if (halted) {
+      statePtr->headRB = headRB;
+      statePtr->tailRB = tailRB;
+      statePtr->halted = 1;
+      break;
+    }
+
+    /*
+     * 提交完成.
+     * 检查所有保留站中的指令, 对下列状态, 分别完成所需的操作:
+     */
+    int RBNum = robCount(statePtr, headRB, tailRB);
+    if (headRB == -1) {
+      headRB = 0;
+    }
+    int replay = -1;  // 需要重新执行的最老的 load
+    int busesLeft = cfg->cdbs;  // 本周期剩余的公共数据总线
+    for (int n = 0, i = headRB; n < RBNum; n++, i = nextRB(cfg, i)) {
+      reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+      if (RBPtr->busy == 1 && RBPtr->instrStatus != COMMITTING) {
+        resStation *execUnit = &(statePtr->reservation[RBPtr->execUnit]);
+        if (RBPtr->instrStatus == ISSUING) {
+          /*
+           * 对 Issuing 状态:
+           * 检查两个操作数是否都已经准备好, 如果是, 将指令状态修改为 Executing
+           */
+          if (execUnit->busy == 1) {
+            if (execUnit->Qj == -1 && execUnit->Qk == -1) {
+              int op = RBPtr->dec.op;
+              int fuClass = RBPtr->dec.fuClass;
+              int fu = -1;
+              // 按年龄从老到新分配执行部件
+              if (cfg->fus[fuClass] > 0) {
+                fu = freeFU(statePtr, fuClass);
+                if (fu == -1) {
+                  statePtr->stats.fuStalls++;
+                  continue;
+                }
+              }
+              if (op == LW || op == SW) {
+                // 有数据 cache 时执行周期数由 cache 访问的结果决定
+                if (cfg->cacheSize[L1] > 0) {
+                  int latency = cacheAccess(statePtr, execUnit->Vj + RBPtr->dec.imm, op == SW);
+                  if (latency < 0) {
+                    continue;  // 没有空闲的 MSHR, 下个周期再试
+                  }
+                  execUnit->exTimeLeft = latency;
+                }
+                statePtr->stats.memAccesses++;
+                statePtr->stats.memCycles += execUnit->exTimeLeft;
+              }
+              if (fu != -1) {
+                int ii = cfg->fuII[fuClass];
+                statePtr->fuFree[fu] = statePtr->cycles + ((ii > 0) ? ii : execUnit->exTimeLeft);
+              }
+              RBPtr->instrStatus = EXECUTING;
+            }
+          }
+        } else if (RBPtr->instrStatus == EXECUTING) {
+          /*
+           * 对 Executing 状态:
+           * 执行剩余时间递减;
+           * 在执行完成时, 将指令状态修改为 Writing Result
+           */
+          if (execUnit->busy == 1) {
+            execUnit->exTimeLeft--;
+            if (execUnit->exTimeLeft == 0) {
+              RBPtr->instrStatus = WRITINGRESULT;
+            }
+          }
+        } else if (RBPtr->instrStatus == WRITINGRESULT) {
+          /* 
+           * 对 Writing Result 状态:
+           * 将结果复制到正在等待该结果的其他保留站中去;
+           * 还需要将结果保存在 ROB 中的临时存储区中.
+           * 释放指令占用的保留站, 将指令状态修改为 Committing
+           */
+          // 计算结果
+          decodedInstr *d = &(RBPtr->dec);
+          int result = 0;
+          // 产生寄存器结果的指令需要占用一条公共数据总线, 按年龄从老到新分配
+          if (d->rd != -1 && cfg->cdbs > 0) {
+            if (busesLeft == 0) {
+              statePtr->stats.cdbStalls++;
+              continue;
+            }
+          }
+          switch (d->op) {
+            case LW:
+              if (!loadValue(statePtr, headRB, i, &result)) {
+                statePtr->stats.loadWaits++;
+                continue;  // 等待更老的 store 算出地址
+              }
+              break;
+            case SW:
+              result = execUnit->Vk;
+              RBPtr->storeAddress = execUnit->Vj + d->imm;
+              if (cfg->memSpec) {
+                int j = orderViolation(statePtr, tailRB, i);
+                if (j != -1 && (replay == -1 || statePtr->reorderBuf[j].seq < statePtr->reorderBuf[replay].seq)) {
+                  replay = j;
+                }
+              }
+              break;
+            case regRegALU:
+              switch (d->func) {
+                case addFunc:
+                  result = execUnit->Vj + execUnit->Vk;
+                  break;
+                case subFunc:
+                  result = execUnit->Vj - execUnit->Vk;
+                  break;
+                case orFunc:
+                  result = execUnit->Vj | execUnit->Vk;
+                  break;
+                case xorFunc:
+                  result = execUnit->Vj ^ execUnit->Vk;
+                  break;
+                case sltFunc:
+                  result = (execUnit->Vj < execUnit->Vk) ? 1 : 0;
+                  break;
+                case sllFunc:
+                  result = (int) ((unsigned int) execUnit->Vj << (execUnit->Vk & 31));
+                  break;
+                case srlFunc:
+                  result = (int) ((unsigned int) execUnit->Vj >> (execUnit->Vk & 31));
+                  break;
+                case mulFunc:
+                  result = (int) ((unsigned int) execUnit->Vj * (unsigned int) execUnit->Vk);
+                  break;
+                case divFunc:
+                  if (execUnit->Vk == 0) {
+                    result = 0;
+                  } else if (execUnit->Vk == -1) {  // 避免 INT_MIN / -1 溢出
+                    result = (int) (0u - (unsigned int) execUnit->Vj);
+                  } else {
+                    result = execUnit->Vj / execUnit->Vk;
+                  }
+                  break;
+                default:
+                  result = execUnit->Vj & execUnit->Vk;
+                  break;
+              }
+              break;
+            case ADDI:
+              result = execUnit->Vj + d->imm;
+              break;
+            case ANDI:
+              result = execUnit->Vj & d->imm;
+              break;
+            case ORI:
+              result = execUnit->Vj | d->imm;
+              break;
+            case XORI:
+              result = execUnit->Vj ^ d->imm;
+              break;
+            case SLTI:
+              result = (execUnit->Vj < d->imm) ? 1 : 0;
+              break;
+            case SLLI:
+              result = (int) ((unsigned int) execUnit->Vj << (d->imm & 31));
+              break;
+            case SRLI:
+              result = (int) ((unsigned int) execUnit->Vj >> (d->imm & 31));
+              break;
+            case BEQZ:
+              result = execUnit->Vk + d->imm;
+              RBPtr->branchCmp = (execUnit->Vj == 0) ? 1 : 0;
+              break;
+            case BNEZ:
+              result = execUnit->Vk + d->imm;
+              RBPtr->branchCmp = (execUnit->Vj != 0) ? 1 : 0;
+              break;
+            case J:
+              result = execUnit->Vk + d->imm;
+              break;
+            case JAL:
+              result = execUnit->Vk;  // 返回地址
+              break;
+            case JR:
+              result = execUnit->Vj;
+              break;
+            default:
+              break;
+          }
+          // 写回 ROB, 物理寄存器模式下寄存器结果写回物理寄存器
+          RBPtr->valid = 1;
+          RBPtr->result = result;
+          if (cfg->physRegs > 0 && d->rd != -1) {
+            statePtr->physFile[RBPtr->physDest] = result;
+            statePtr->physReady[RBPtr->physDest] = 1;
+          }
+          if (d->rd != -1) {
+            busesLeft--;
+          }
+          // 分支在执行完成时确定结果, 预测错误时队尾退到这条分支
+          if (cfg->earlyResolve && (isBranch(d->op) || isJump(d->op)) && resolveBranch(statePtr, headRB, tailRB, i)) {
+            tailRB = i;
+            RBNum = n + 1;
+            chargeFlush(statePtr, i);
+            flushed = 1;
+            // 更老的 store 选中的重新执行的 load 在错误路径上, 已经被清除
+            if (replay != -1 && statePtr->reorderBuf[replay].seq > RBPtr->seq) {
+              replay = -1;
+            }
+          }
+          // 通过公共数据总线唤醒等待这个结果的保留站
+          wakeup(statePtr, i, result);
+          // 释放保留站
+          execUnit->busy = 0;
+          RBPtr->instrStatus = COMMITTING;
+        }
+      }
+    }
+
+    /*
+     * load 越过了地址相同的 store 读到了旧值: 清除这条 load 和之后的所有指令,
+     * 从 load 处重新取指执行. 这条 load 已经被同一周期确定的分支清除时不用重新执行.
+     */
+    if (replay != -1 && statePtr->reorderBuf[replay].busy) {
+      statePtr->stats.replays++;
+      redirectFetch(statePtr, statePtr->reorderBuf[replay].pc);
+      squashFrom(statePtr, headRB, tailRB, replay);
+      chargeFlush(statePtr, replay);
+      flushed = 1;
+      rebuildRegResult(statePtr, headRB, replay);
+      rebuildRenameMap(statePtr, headRB, replay);
+      tailRB = prevRB(cfg, replay);
+      RBNum = (replay - headRB + cfg->rbSize) % cfg->rbSize;
+    }
+
+    /*
+     * 最后, 当我们处理完了保留站中的所有指令后, 检查是否能够发射新的指令.
+     * 每个周期按程序顺序最多发射 cfg->issueWidth 条指令, 同一组中后面的指令
+     * 通过 regResult 看到前面指令的 ROB 编号, 因此组内的相关由重命名自然处理.
+     * 首先检查 ROB 中是否有空闲的空间,
+     * 如果有，再检查所需运算单元是否有空闲的保留站,
+     * 如果有, 发射指令.
+     * 
+     * 在ROB的队尾检查是否有空闲的空间,
+     * ROB是一个循环队列, 它可以容纳 cfg->rbSize 个项目.
+     * 新的指令被添加到队列的末尾, 指令提交则是从队首进行的.
+     * 当队列的首指针或尾指针到达数组中的最后一项时, 它应滚动到数组的第一项.
+     * 
+     * 发射指令:
+     * 填写保留站和 ROB 项的内容.
+     * 注意, 要在所有的字段中写入正确的值.
+     * 检查寄存器状态, 相应的在 Vj,Vk 和 Qj,Qk 字段中设置正确的值:
+     * 对于 I 类型指令, 设置 Qk=0,Vk=0;
+     * 对于 SW 指令, 如果寄存器有效, 将寄存器中的内存基地址保存在 Vj 中;
+     * 对于条件分支和 J 型指令, 将当前 PC+1 的值保存在 Vk 字段中.
+     * 如果指令在提交时会修改寄存器的值, 还需要在这里更新寄存器状态数据结构.
+     */
+    int issuedFrom = RBNum;
+    for (int w = 0; w < cfg->issueWidth && RBNum < cfg->rbSize; w++) {
+      // 没有取指阶段时直接读内存中 PC 处的指令, 否则读取指队列的队首
+      decodedInstr tmp;
+      decodedInstr *d;
+      if (cfg->fetchQueue == 0) {
+        if (statePtr->pc >= memorySize) {
+          break;
+        }
+        d = fetchDecoded(statePtr, statePtr->pc, &tmp);
+      } else {
+        if (statePtr->fqCount == 0) {
+          if (w == 0) {
+            statePtr->stats.fetchBubbles++;
+          }
+          break;
+        }
+        d = &(statePtr->fetchQueue[statePtr->fqHead].dec);
+      }
+      int jumpNow = jumpsAtIssue(cfg, d);
+      int execUnit = jumpNow ? -1 : freeUnit(statePtr, d->unitClass);
+      if (!jumpNow && execUnit == -1) {
+        break;  // 按程序顺序发射, 后面的指令也必须等待
+      }
+      if (noPhysReg(statePtr, d)) {
+        break;
+      }
+      // 取出指令和取指时的预测, 没有取指阶段时在这里预测并修改 PC
+      fetchEntry fe;
+      if (cfg->fetchQueue == 0) {
+        fetchInstr(statePtr, &fe);
+      } else {
+        fe = statePtr->fetchQueue[statePtr->fqHead];
+        statePtr->fqHead = (statePtr->fqHead + 1) % cfg->fetchQueue;
+        statePtr->fqCount--;
+      }
+      d = &(fe.dec);
+      // 提交到 ROB
+      tailRB = nextRB(cfg, tailRB);
+      statePtr->reorderBuf[tailRB].busy = 1;
+      statePtr->reorderBuf[tailRB].instr = d->instr;
+      statePtr->reorderBuf[tailRB].execUnit = execUnit;
+      statePtr->reorderBuf[tailRB].instrStatus = ISSUING;
+      statePtr->reorderBuf[tailRB].valid = 0;
+      statePtr->reorderBuf[tailRB].dec = *d;
+      statePtr->reorderBuf[tailRB].pc = fe.pc;
+      statePtr->reorderBuf[tailRB].seq = statePtr->seqNum++;
+      statePtr->reorderBuf[tailRB].issueCycle = statePtr->cycles;
+      statePtr->reorderBuf[tailRB].issueMark = statePtr->stats.cycleCauses[CYCLE_ISSUE] + 1;
+      statePtr->reorderBuf[tailRB].haltMark = statePtr->stats.cycleCauses[CYCLE_HALT];
+      statePtr->reorderBuf[tailRB].resolved = 0;
+      statePtr->reorderBuf[tailRB].mispredicted = 0;
+      statePtr->reorderBuf[tailRB].predHist = fe.predHist;
+      statePtr->reorderBuf[tailRB].predPC = fe.predPC;
+      if (isBranch(d->op)) {
+        statePtr->reorderBuf[tailRB].branchPC = fe.pc;
+      }
+      if (jumpNow) {
+        // 跳转目标在取指时就已算出: 不占用保留站, 直接等待提交
+        statePtr->reorderBuf[tailRB].instrStatus = COMMITTING;
+        statePtr->reorderBuf[tailRB].valid = 1;
+        statePtr->reorderBuf[tailRB].result = (d->op == JAL) ? fe.pc + 1 : fe.predPC;
+        statePtr->reorderBuf[tailRB].resolved = 1;
+        if (cfg->physRegs > 0 && d->rd != -1) {
+          int p = renameDest(statePtr, tailRB);
+          statePtr->physFile[p] = fe.pc + 1;
+          statePtr->physReady[p] = 1;
+        }
+        if (d->rd != -1) {
+          statePtr->regResult[d->rd].valid = 0;
+          statePtr->regResult[d->rd].reorderNum = tailRB;
+        }
+        RBNum++;
+        if (cfg->fetchQueue == 0) {
+          break;  // 跳转之后的指令留到下一个周期再发射
+        }
+        continue;
+      }
+      // 提交到保留站
+      resStation *rs = &(statePtr->reservation[execUnit]);
+      rs->busy = 1;
+      rs->instr = d->instr;
+      // Vj, Qj
+      if (d->format != FORMAT_J) {
+        readOperand(statePtr, d->rs1, &(rs->Vj), &(rs->Qj));
+        if (rs->Qj != -1) {
+          addConsumer(statePtr, rs->Qj, execUnit, 0);
+        }
+      } else {
+        rs->Qj = -1;  // 不使用 Vj, 不能等待保留站中残留的 Qj
+      }
+      // Vk, Qk
+      if (d->format == FORMAT_R || d->op == SW) {
+        readOperand(statePtr, d->rs2, &(rs->Vk), &(rs->Qk));
+        if (rs->Qk != -1) {
+          addConsumer(statePtr, rs->Qk, execUnit, 1);
+        }
+      } else if (isBranch(d->op) || d->format == FORMAT_J) {
+        rs->Vk = fe.pc + 1;
+        rs->Qk = -1;
+      } else {
+        rs->Vk = 0;
+        rs->Qk = -1;
+      }
+      rs->exTimeLeft = cfg->latency[d->latClass];
+      rs->reorderNum = tailRB;
+      if (d->op == HALT) {
+        statePtr->haltsInFlight++;
+      }
+      // 读完源操作数之后再重命名目的寄存器
+      if (cfg->physRegs > 0 && d->rd != -1) {
+        renameDest(statePtr, tailRB);
+      }
+      // 更新寄存器状态
+      if (d->rd != -1) {
+        statePtr->regResult[d->rd].valid = 0;
+        statePtr->regResult[d->rd].reorderNum = tailRB;
+      }
+      // 保存检查点, 分支在执行完成时预测错误可以从这里恢复寄存器状态
+      if (cfg->earlyResolve && (isBranch(d->op) || isJump(d->op))) {
+        memcpy(&(statePtr->checkpoints[tailRB * NUMREGS]), statePtr->regResult, sizeof(statePtr->regResult));
+      }
+      RBNum++;
+      // 没有取指阶段时, 分支和跳转之后的指令留到下一个周期再发射
+      if (cfg->fetchQueue == 0 && (isBranch(d->op) || isJump(d->op))) {
+        break;
+      }
+    }
+
+    /*
+     * 取指阶段在发射之后进行, 本周期取到的指令下个周期才能发射
+     */
+    if (cfg->fetchQueue > 0) {
+      fetchStage(statePtr, memorySize);
+    }
+
+    /*
+     * 本周期归类
+     */
+    int cause = CYCLE_ISSUE;
+    if (statePtr->haltsInFlight > 0) {
+      cause = CYCLE_HALT;
+    } else if (RBNum == issuedFrom) {
+      cause = flushed ? CYCLE_FLUSH : stallCause(statePtr, RBNum, memorySize);
+    }
+    countCycles(statePtr, cause, RBNum, 1);
+	    
+    /*
+    * 周期计数加1
+    */
+    statePtr->cycles++;
+  }  /* while (1) */
+
+  return statePtr->fault ? SIM_FAULT : SIM_HALT;
+}
+
+/*
+ * 程序的代码和数据是否都在 memSize 个字的地址空间内, memSize 为 0 时不限制
+ */
+int programFits(program *prog, int memSize) {
+  if (memSize <= 0) {
+    return 1;
+  }
+  if (prog->size > memSize) {
+    return 0;
+  }
+  for (int i = 0; i < prog->numData; i++) {
+    if (prog->data[i].address + (long long) prog->data[i].count > memSize) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * 读入十进制格式的机器指令文件 (每行一个十进制整数), 从地址 16 开始存放
+ */
+void loadDecimal(FILE *filePtr, program *prog, int limit) {
+  char line[MAXLINELENGTH];
+  int instr;
+  int capacity = 1024;
+  prog->words = (int *) calloc(capacity, sizeof(int));
+  int pc = 16;
+  while (fgets(line, MAXLINELENGTH, filePtr) != NULL) {
+    if (pc >= limit) {
+      printf("error: program does not fit in %d words of memory\n", limit);
+      exit(1);
+    }
+    if (sscanf(line, "%d\n", &instr) != 1) {
+      printf("error in reading address %d\n", pc);
+      exit(1);
+    }
+    if (pc >= capacity) {
+      prog->words = (int *) realloc(prog->words, 2 * capacity * sizeof(int));
+      memset(prog->words + capacity, 0, capacity * sizeof(int));
+      capacity *= 2;
+    }
+    prog->words[pc] = instr;
+    pc = pc + 1;
+  }
+  prog->size = pc;
+}
+
+unsigned int little32(unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+/*
+ * 读入二进制目标文件 (格式见 OBJ_MAGIC). 整个文件映射到内存,
+ * 先由段表确定代码的结束地址, 再把每段的内容直接复制到代码或数据段中.
+ */
+void loadObject(FILE *filePtr, program *prog, int limit) {
+  struct stat st;
+  if (fstat(fileno(filePtr), &st) < 0) {
+    perror("fstat");
+    exit(1);
+  }
+  size_t fileSize = st.st_size;
+  unsigned char *image = (unsigned char *) mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fileno(filePtr), 0);
+  if (image == MAP_FAILED) {
+    printf("error: can't map the program file");
+    perror("mmap");
+    exit(1);
+  }
+  if (fileSize < 12 || little32(image + 4) != OBJ_VERSION) {
+    printf("error: unsupported object file version\n");
+    exit(1);
+  }
+  unsigned int numSegs = little32(image + 8);
+  if (numSegs > (fileSize - 12) / 16) {
+    printf("error: corrupt object file\n");
+    exit(1);
+  }
+  prog->size = 16;
+  prog->numData = 0;
+  for (unsigned int k = 0; k < numSegs; k++) {
+    unsigned char *entry = image + 12 + 16 * k;
+    unsigned int kind = little32(entry), address = little32(entry + 4), count = little32(entry + 8);
+    if ((kind != SEG_CODE && kind != SEG_DATA) || (unsigned long long) address + count > 1ULL << 32 ||
+        little32(entry + 12) + 4ULL * count > fileSize) {
+      printf("error: corrupt object file\n");
+      exit(1);
+    }
+    if (kind == SEG_CODE && address + (long long) count > limit) {
+      printf("error: program does not fit in %d words of memory\n", limit);
+      exit(1);
+    }
+    if (kind == SEG_CODE && address + count > prog->size) {
+      prog->size = address + count;
+    } else if (kind == SEG_DATA) {
+      prog->numData++;
+    }
+  }
+  prog->words = (int *) calloc(prog->size, sizeof(int));
+  prog->data = (segment *) malloc(prog->numData * sizeof(segment));
+  if (prog->words == NULL || (prog->numData > 0 && prog->data == NULL)) {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  int numData = 0;
+  for (unsigned int k = 0; k < numSegs; k++) {
+    unsigned char *entry = image + 12 + 16 * k;
+    unsigned int address = little32(entry + 4), count = little32(entry + 8);
+    unsigned char *p = image + little32(entry + 12);
+    int *words = prog->words + address;
+    if (little32(entry) == SEG_DATA) {
+      segment *seg = &(prog->data[numData++]);
+      seg->address = address;
+      seg->count = count;
+      seg->words = words = (int *) malloc(count * sizeof(int));
+      if (words == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+      }
+    }
+    for (unsigned int i = 0; i < count; i++, p += 4) {
+      words[i] = (int) little32(p);
+    }
+  }
+  munmap(image, fileSize);
+}
+
+/*
+ * 读入机器指令文件, 十进制格式或二进制目标文件, 并对代码的每个字解码一次.
+ * memSize 为地址空间的大小, 0 表示不限制.
+ */
+program *loadProgram(FILE *filePtr, int memSize) {
+  char magic[4];
+  program *prog = (program *) malloc(sizeof(program));
+  int limit = (memSize > 0) ? memSize : MAXPROGRAMSIZE;
+  prog->numData = 0;
+  prog->data = NULL;
+  if (fread(magic, 1, 4, filePtr) == 4 && memcmp(magic, OBJ_MAGIC, 4) == 0) {
+    loadObject(filePtr, prog, limit);
+  } else {
+    rewind(filePtr);
+    loadDecimal(filePtr, prog, limit);
+  }
+  if (!programFits(prog, memSize)) {
+    printf("error: program does not fit in %d words of memory\n", memSize);
+    exit(1);
+  }
+  prog->decoded = (decodedInstr *) malloc(prog->size * sizeof(decodedInstr));
+  for (int i = 0; i < prog->size; i++) {
+    decodeInstr(prog->words[i], &(prog->decoded[i]));
+  }
+  return prog;
+}
+
+/*
+ * 状态初始化: 装入程序, 清空寄存器, 保留站, ROB 和 BTB
+ */
+void initMachine(machineState *statePtr, program *prog) {
+  machineConfig *cfg = statePtr->config;
+  clearPages(statePtr->memory);
+  for (int i = 0; i < prog->size; i++) {
+    writeWord(statePtr, i, prog->words[i]);
+  }
+  for (int k = 0; k < prog->numData; k++) {
+    for (int i = 0; i < prog->data[k].count; i++) {
+      writeWord(statePtr, prog->data[k].address + i, prog->data[k].words[i]);
+    }
+  }
+  statePtr->decoded = prog->decoded;
+  statePtr->pc = 16;
+  statePtr->cycles = 0;
+  memset(&(statePtr->stats), 0, sizeof(simStats));
+  statePtr->seqNum = 0;
+  statePtr->headRB = -1;
+  statePtr->tailRB = -1;
+  statePtr->halted = 0;
+  statePtr->fault = 0;
+  for (int i = 0; i < NUMREGS; i++) {
+    statePtr->regFile[i] = 0;
+    statePtr->regResult[i].valid = 1;
+    statePtr->archMap[i] = i;
+  }
+  if (cfg->physRegs > 0) {
+    memset(statePtr->physFile, 0, cfg->physRegs * sizeof(int));
+    for (int p = 0; p < cfg->physRegs; p++) {
+      statePtr->physReady[p] = 1;
+    }
+    rebuildRenameMap(statePtr, 0, 0);
+  }
+  for (int i = 0; i < cfg->numUnits; i++) {
+    statePtr->reservation[i].busy = 0;
+  }
+  for (int i = 0; i < cfg->rbSize; i++) {
+    statePtr->reorderBuf[i].busy = 0;
+    statePtr->consumerHead[i] = -1;
+  }
+  for (int i = 0; i < cfg->btbSize; i++) {
+    statePtr->btBuf[i].valid = 0;
+    statePtr->btBuf[i].lastUse = 0;
+  }
+  statePtr->btbClock = 0;
+  for (int k = 0; k < NUMCACHES; k++) {
+    memset(statePtr->cache[k], 0, cfg->cacheSize[k] / cfg->lineSize[k] * sizeof(cacheLine));
+  }
+  memset(statePtr->mshr, 0, cfg->mshrs * sizeof(mshrEntry));
+  statePtr->cacheClock = 0;
+  statePtr->fqHead = 0;
+  statePtr->fqCount = 0;
+  statePtr->fetchReady = 0;
+  statePtr->haltsInFlight = 0;
+  memset(statePtr->unitBusy, 0, cfg->numUnits * sizeof(long long));
+  memset(statePtr->robHist, 0, (cfg->rbSize + 1) * sizeof(long long));
+  memset(statePtr->fuFree, 0, cfg->numFUs * sizeof(int));
+  size_t tableSize = (size_t) 1 << cfg->phtBits;
+  statePtr->ghr = 0;
+  memset(statePtr->tage, 0, NUMTAGE * tableSize * sizeof(tageEntry));
+  memset(statePtr->bimodal, 0, tableSize);
+  memset(statePtr->pht, 0, tableSize);
+  memset(statePtr->choice, 0, tableSize);
+}
+
+/*
+ * 读取 bytes 字节的小端序整数, 文件结束时返回 -1
+ */
+long long getLittle(FILE *fp, int bytes) {
+  unsigned long long value = 0;
+  for (int i = 0; i < bytes; i++) {
+    int c = fgetc(fp);
+    if (c == EOF) {
+      return -1;
+    }
+    value |= (unsigned long long) c << (8 * i);
+  }
+  return (long long) value;
+}
+
+/*
+ * 读入 putWords 压缩的 n 个字, 数据有误时返回 0
+ */
+int getWords(FILE *fp, unsigned int *words, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    long long zeros = getLittle(fp, 4);
+    long long literals = getLittle(fp, 4);
+    if (zeros < 0 || literals < 0 || i + zeros + literals > n ||
+        fread(&words[i + zeros], 4, literals, fp) != literals) {
+      return 0;
+    }
+    memset(&words[i], 0, zeros * 4);
+    i += zeros + literals;
+  }
+  return 1;
+}
+
+/*
+ * 从检查点文件中恢复周期数不超过 cycle 的最后一个检查点, cycle 为负数时恢复最后一个检查点.
+ * 文件头与当前的参数或程序不一致时报错退出. 返回恢复的周期数, 没有可用的检查点时返回 -1.
+ */
+int readCheckpoint(FILE *fp, machineState *statePtr, int memorySize, int cycle) {
+  char magic[4];
+  machineConfig key, saved;
+  ckptConfig(statePtr->config, &key);
+  if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, CKPT_MAGIC, 4) != 0 ||
+      getLittle(fp, 4) != CKPT_VERSION) {
+    printf("error: not a checkpoint file\n");
+    exit(1);
+  }
+  long long blockSize = getLittle(fp, 8);
+  long long programSize = getLittle(fp, 4);
+  long long keySize = getLittle(fp, 4);
+  if (keySize != offsetof(machineConfig, numUnits) || fread(&saved, 1, keySize, fp) != keySize ||
+      blockSize != statePtr->blockSize || memcmp(&saved, &key, keySize) != 0) {
+    printf("error: checkpoint was taken with different machine parameters\n");
+    exit(1);
+  }
+  if (programSize != memorySize) {
+    printf("error: checkpoint was taken with a different program\n");
+    exit(1);
+  }
+  // 找到要恢复的记录
+  long found = -1;
+  int foundCycle = -1;
+  while (1) {
+    int type = fgetc(fp);
+    long long recordCycle = getLittle(fp, 4);
+    long long length = getLittle(fp, 8);
+    if (type != CKPT_RECORD || length < 0) {
+      break;
+    }
+    if (cycle >= 0 && recordCycle > cycle) {
+      break;
+    }
+    found = ftell(fp);
+    foundCycle = recordCycle;
+    fseek(fp, length, SEEK_CUR);
+  }
+  if (found < 0) {
+    return -1;
+  }
+  // 解压, 再恢复只属于本进程的指针, 最后恢复写过的页
+  machineConfig *cfg = statePtr->config;
+  decodedInstr *decoded = statePtr->decoded;
+  pageTable *memory = statePtr->memory;
+  fseek(fp, found, SEEK_SET);
+  int ok = getWords(fp, (unsigned int *) statePtr, statePtr->blockSize / 4);
+  statePtr->config = cfg;
+  statePtr->decoded = decoded;
+  statePtr->memory = memory;
+  layoutMachine(statePtr);
+  clearPages(memory);
+  long long numPages = getLittle(fp, 4);
+  for (long long i = 0; ok && i < numPages; i++) {
+    long long number = getLittle(fp, 4);
+    ok = number >= 0 && getWords(fp, (unsigned int *) touchPage(memory, number << PAGEBITS)->data, PAGEWORDS);
+  }
+  if (!ok || numPages < 0) {
+    printf("error: corrupt checkpoint at cycle %d\n", foundCycle);
+    exit(1);
+  }
+  return foundCycle;
+}
+
+/*
+ * 跳到周期 cycle: 恢复不超过它的最后一个检查点, 再不输出状态地运行到 cycle.
+ * 程序在此之前停机时停在停机的周期. 返回 -1 表示没有可用的检查点.
+ */
+int seekMachine(FILE *fp, machineState *statePtr, int memorySize, int cycle) {
+  if (readCheckpoint(fp, statePtr, memorySize, cycle) < 0) {
+    return -1;
+  }
+  if (statePtr->cycles < cycle) {
+    machineConfig *cfg = statePtr->config;
+    traceWriter none;
+    none.format = TRACE_NONE;
+    none.ckptFp = NULL;
+    int maxCycles = cfg->maxCycles;
+    cfg->maxCycles = cycle;
+    simulate(statePtr, &none, memorySize);
+    cfg->maxCycles = maxCycles;
+  }
+  return statePtr->cycles;
+}
+
+/*
+ * 释放 finishConfig 生成的表
+ */
+void freeConfig(machineConfig *cfg) {
+  for (int i = 0; i < cfg->numUnits; i++) {
+    free(cfg->unitname[i]);
+  }
+  free(cfg->unitname);
+  free(cfg->unitclass);
+}
+
+/*
+ * 参数扫描: 同一个程序在多组机器参数下各运行一次, 结果汇总成一张表.
+ * 程序只装入和解码一次, 每组参数使用独立的 machineState, 由线程池并行运行.
+ */
+typedef struct _sweepJob {
+  machineConfig config;  // 本组参数
+  int status;            // simulate 的返回值, -1 表示参数不可用
+  int cycles;            // 运行周期数
+  simStats stats;        // 运行统计
+  double seconds;        // 运行时间
+} sweepJob;
+
+/*
+ * 每个线程的任务队列, 存放任务编号区间 [head, tail).
+ * 线程从队尾取自己的任务, 空闲时从其他线程的队首窃取任务.
+ */
+typedef struct _workQueue {
+  pthread_mutex_t lock;
+  int head;
+  int tail;
+} workQueue;
+
+typedef struct _sweepPool {
+  sweepJob *jobs;
+  int numJobs;
+  program *prog;
+  workQueue *queues;
+  int numThreads;
+} sweepPool;
+
+typedef struct _sweepWorker {
+  sweepPool *pool;
+  int id;
+} sweepWorker;
+
+/*
+ * 将一行 "key=v1,v2,... key=..." 展开成各取值的笛卡尔积, 追加到 jobs 中
+ */
+int expandSweepLine(machineConfig *base, char *line, sweepJob **jobs, int *numJobs, int *capacity) {
+  char *keys[NUMCONFIGKEYS];
+  char *values[NUMCONFIGKEYS][MAXLINELENGTH / 2];
+  int numValues[NUMCONFIGKEYS], choice[NUMCONFIGKEYS];
+  int numKeys = 0;
+  char *comment = strchr(line, '#');
+  if (comment != NULL) {
+    *comment = '\0';
+  }
+  for (char *tok = strtok(line, " \t\r\n"); tok != NULL; tok = strtok(NULL, " \t\r\n")) {
+    char *eq = strchr(tok, '=');
+    if (eq == NULL || numKeys == NUMCONFIGKEYS) {
+      return -1;
+    }
+    *eq = '\0';
+    keys[numKeys] = tok;
+    numValues[numKeys] = 0;
+    for (char *v = eq + 1; v != NULL; ) {
+      char *comma = strchr(v, ',');
+      if (comma != NULL) {
+        *comma = '\0';
+      }
+      values[numKeys][numValues[numKeys]++] = v;
+      v = (comma != NULL) ? comma + 1 : NULL;
+    }
+    choice[numKeys] = 0;
+    numKeys++;
+  }
+  if (numKeys == 0) {
+    return 0;
+  }
+  while (1) {
+    if (*numJobs == *capacity) {
+      *capacity *= 2;
+      *jobs = (sweepJob *) realloc(*jobs, *capacity * sizeof(sweepJob));
+    }
+    sweepJob *job = &((*jobs)[*numJobs]);
+    memset(job, 0, sizeof(sweepJob));
+    job->config = *base;
+    for (int k = 0; k < numKeys; k++) {
+      if (setConfig(&(job->config), keys[k], values[k][choice[k]]) != 0) {
+        return -1;
+      }
+    }
+    (*numJobs)++;
+    // 下一种组合
+    int k = numKeys - 1;
+    while (k >= 0 && ++choice[k] == numValues[k]) {
+      choice[k--] = 0;
+    }
+    if (k < 0) {
+      return 0;
+    }
+  }
+}
+
+/*
+ * 读取扫描文件, 返回任务数
+ */
+int readSweep(machineConfig *base, char *path, sweepJob **jobs) {
+  char line[MAXLINELENGTH];
+  int numJobs = 0, capacity = 64;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("error: can't open file %s", path);
+    perror("fopen");
+    exit(1);
+  }
+  *jobs = (sweepJob *) malloc(capacity * sizeof(sweepJob));
+  for (int lineNum = 1; fgets(line, MAXLINELENGTH, fp) != NULL; lineNum++) {
+    if (expandSweepLine(base, line, jobs, &numJobs, &capacity) != 0) {
+      printf("error: %s:%d: bad sweep line\n", path, lineNum);
+      exit(1);
+    }
+  }
+  fclose(fp);
+  return numJobs;
+}
+
+/*
+ * 运行一个扫描任务
+ */
+void runSweepJob(sweepJob *job, program *prog) {
+  machineConfig *cfg = &(job->config);
+  if (!programFits(prog, cfg->memSize) || configError(cfg) != NULL) {
+    job->status = -1;
+    return;
+  }
+  traceWriter none;
+  none.format = TRACE_NONE;
+  none.ckptFp = NULL;
+  finishConfig(cfg);
+  machineState *statePtr = newMachine(cfg);
+  initMachine(statePtr, prog);
+  double start = now();
+  job->status = simulate(statePtr, &none, prog->size);
+  job->seconds = now() - start;
+  job->cycles = statePtr->cycles;
+  job->stats = statePtr->stats;
+  freeMachine(statePtr);
+  freeConfig(cfg);
+  cfg->numUnits = 0;
+}
+
+/*
+ * 从自己的队尾取一个任务, 没有则从其他线程的队首窃取, 都没有时返回 -1
+ */
+int nextSweepJob(sweepPool *pool, int self) {
+  for (int n = 0; n < pool->numThreads; n++) {
+    workQueue *q = &(pool->queues[(self + n) % pool->numThreads]);
+    int job = -1;
+    pthread_mutex_lock(&(q->lock));
+    if (q->head < q->tail) {
+      job = (n == 0) ? --q->tail : q->head++;
+    }
+    pthread_mutex_unlock(&(q->lock));
+    if (job != -1) {
+      return job;
+    }
+  }
+  return -1;
+}
+
+void *sweepThread(void *arg) {
+  sweepWorker *worker = (sweepWorker *) arg;
+  sweepPool *pool = worker->pool;
+  int job;
+  while ((job = nextSweepJob(pool, worker->id)) != -1) {
+    runSweepJob(&(pool->jobs[job]), pool->prog);
+  }
+  return NULL;
+}
+
+/*
+ * 用 numThreads 个线程运行所有任务. 任务按编号平均分到各线程的队列中.
+ */
+void runSweep(sweepJob *jobs, int numJobs, program *prog, int numThreads) {
+  sweepPool pool;
+  pool.jobs = jobs;
+  pool.numJobs = numJobs;
+  pool.prog = prog;
+  pool.numThreads = numThreads;
+  pool.queues = (workQueue *) malloc(numThreads * sizeof(workQueue));
+  pthread_t *threads = (pthread_t *) malloc(numThreads * sizeof(pthread_t));
+  sweepWorker *workers = (sweepWorker *) malloc(numThreads * sizeof(sweepWorker));
+  for (int i = 0; i < numThreads; i++) {
+    pthread_mutex_init(&(pool.queues[i].lock), NULL);
+    pool.queues[i].head = (long long) numJobs * i / numThreads;
+    pool.queues[i].tail = (long long) numJobs * (i + 1) / numThreads;
+  }
+  for (int i = 0; i < numThreads; i++) {
+    workers[i].pool = &pool;
+    workers[i].id = i;
+    pthread_create(&threads[i], NULL, sweepThread, &workers[i]);
+  }
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  for (int i = 0; i < numThreads; i++) {
+    pthread_mutex_destroy(&(pool.queues[i].lock));
+  }
+  free(pool.queues);
+  free(threads);
+  free(workers);
+}
+
+/*
+ * 输出扫描结果, 每组参数一行 (CSV) 或一个对象 (JSON)
+ */
+void printSweep(sweepJob *jobs, int numJobs, int json) {
+  char *statusName[] = {"halt", "limit", "fault"};
+  if (json) {
+    printf("[\n");
+  } else {
+    for (int k = 0; k < NUMCONFIGKEYS; k++) {
+      printf("%s,", configKeys[k].name);
+    }
+    printf("status,cycles,ipc,");
+    for (int k = 0; k < NUMSTATKEYS; k++) {
+      printf("%s,", statKeys[k].column);
+    }
+    printf("accuracy,mpki,l1hitrate,l2hitrate,avgmemlatency,seconds\n");
+  }
+  for (int i = 0; i < numJobs; i++) {
+    sweepJob *job = &jobs[i];
+    char *status = (job->status < 0) ? "error" : statusName[job->status];
+    double ipc = job->cycles ? (double) job->stats.instructions / job->cycles : 0.0;
+    if (json) {
+      printf("  {");
+      for (int k = 0; k < NUMCONFIGKEYS; k++) {
+        int v = *(int *) ((char *) &(job->config) + configKeys[k].offset);
+        if (configKeys[k].names != NULL) {
+          printf("\"%s\": \"%s\", ", configKeys[k].name, configKeys[k].names[v]);
+        } else {
+          printf("\"%s\": %d, ", configKeys[k].name, v);
+        }
+      }
+      printf("\"status\": \"%s\", \"cycles\": %d, \"ipc\": %.4f, ", status, job->cycles, ipc);
+      for (int k = 0; k < NUMSTATKEYS; k++) {
+        printf("\"%s\": %lld, ", statKeys[k].column, statValue(&(job->stats), k));
+      }
+      printf("\"accuracy\": %.4f, \"mpki\": %.4f, ", accuracy(&(job->stats)), mpki(&(job->stats)));
+      printf("\"l1hitrate\": %.4f, \"l2hitrate\": %.4f, \"avgmemlatency\": %.2f, ", hitRate(&(job->stats), L1),
+             hitRate(&(job->stats), L2), avgMemLatency(&(job->stats)));
+      printf("\"seconds\": %.6f}%s\n", job->seconds, (i == numJobs - 1) ? "" : ",");
+    } else {
+      for (int k = 0; k < NUMCONFIGKEYS; k++) {
+        int v = *(int *) ((char *) &(job->config) + configKeys[k].offset);
+        if (configKeys[k].names != NULL) {
+          printf("%s,", configKeys[k].names[v]);
+        } else {
+          printf("%d,", v);
+        }
+      }
+      printf("%s,%d,%.4f,", status, job->cycles, ipc);
+      for (int k = 0; k < NUMSTATKEYS; k++) {
+        printf("%lld,", statValue(&(job->stats), k));
+      }
+      printf("%.4f,%.4f,%.4f,%.4f,%.2f,%.6f\n", accuracy(&(job->stats)), mpki(&(job->stats)),
+             hitRate(&(job->stats), L1), hitRate(&(job->stats), L2), avgMemLatency(&(job->stats)), job->seconds);
+    }
+  }
+  if (json) {
+    printf("]\n");
+  }
+}
+
+/*
+ * 交互模式: 机器只在收到命令时向前运行, 每次只回复请求的那部分状态.
+ * snaps 按周期递增, 第一份是开始时的状态, 之后是运行经过的每个 interval 整数倍周期的状态.
+ * 快照数达到 MAXSNAPS 时 interval 加倍, 只保留第一份和周期是新 interval 整数倍的快照.
+ */
+typedef struct _simServer {
+  machineState *statePtr;
+  int memorySize;
+  int interval;          // 快照间隔, 快照满时加倍
+  int maxCycles;         // 参数中的周期数上限, 0 表示不限制
+  machineState **snaps;  // 内存快照, 最多 MAXSNAPS 份
+  int numSnaps;
+} simServer;
+
+/*
+ * 输出一个 JSON 字段 "PREFIXi-name": value, 第一个字段前不加逗号
+ */
+void jsonInt(FILE *fp, int *first, char *prefix, unsigned int i, char *name, int value) {
+  fprintf(fp, "%s\"%s%u-%s\": %d", *first ? "" : ", ", prefix, i, name, value);
+  *first = 0;
+}
+
+void jsonStr(FILE *fp, int *first, char *prefix, unsigned int i, char *name, char *value) {
+  fprintf(fp, "%s\"%s%u-%s\": \"%s\"", *first ? "" : ", ", prefix, i, name, value);
+  *first = 0;
+}
+
+/*
+ * 把请求的状态部分写成一个 JSON 对象, 字段名与文本格式的 trace 相同 (见 printFileState)
+ */
+void writeJsonState(FILE *fp, machineState *statePtr, int parts, unsigned int memFrom, int memCount) {
+  machineConfig *cfg = statePtr->config;
+  int first = 1;
+  fprintf(fp, "{");
+  for (int i = 0; (parts & PART_ROB) && i < cfg->rbSize; i++) {
+    reorderEntry *RBPtr = &(statePtr->reorderBuf[i]);
+    jsonInt(fp, &first, "RB", i, "Busy", RBPtr->busy == 1);
+    if (RBPtr->busy != 1) {
+      continue;
+    }
+    jsonInt(fp, &first, "RB", i, "Instr", RBPtr->instr);
+    if (RBPtr->instrStatus != 3) {
+      jsonStr(fp, &first, "RB", i, "ExecUnit", cfg->unitname[RBPtr->execUnit]);
+    }
+    jsonStr(fp, &first, "RB", i, "InstrStatus", statename[RBPtr->instrStatus]);
+    if (RBPtr->dec.op == NOOP || RBPtr->dec.op == HALT) {
+      jsonInt(fp, &first, "RB", i, "Valid", 0);
+    } else {
+      jsonInt(fp, &first, "RB", i, "Valid", RBPtr->valid);
+      if (RBPtr->valid == 1) {
+        jsonInt(fp, &first, "RB", i, "Result", RBPtr->result);
+      }
+    }
+    if (RBPtr->dec.op == SW) {
+      jsonInt(fp, &first, "RB", i, "StoreAddress", RBPtr->storeAddress);
+    }
+    if (isBranch(RBPtr->dec.op)) {
+      jsonInt(fp, &first, "RB", i, "BranchCmp", RBPtr->branchCmp);
+      jsonInt(fp, &first, "RB", i, "BranchPC", RBPtr->branchPC);
+    }
+  }
+  for (int i = 0; (parts & PART_RS) && i < cfg->numUnits; i++) {
+    resStation *RSPtr = &(statePtr->reservation[i]);
+    jsonInt(fp, &first, "RS", i, "Busy", RSPtr->busy == 1);
+    if (RSPtr->busy != 1) {
+      continue;
+    }
+    jsonInt(fp, &first, "RS", i, "Instr", RSPtr->instr);
+    if (RSPtr->Qj == -1) {
+      jsonInt(fp, &first, "RS", i, "Vj", RSPtr->Vj);
+    }
+    if (RSPtr->Qk == -1) {
+      jsonInt(fp, &first, "RS", i, "Vk", RSPtr->Vk);
+    }
+    jsonInt(fp, &first, "RS", i, "Qj", RSPtr->Qj);
+    jsonInt(fp, &first, "RS", i, "Qk", RSPtr->Qk);
+    jsonInt(fp, &first, "RS", i, "ExTimeLeft", RSPtr->exTimeLeft);
+    jsonInt(fp, &first, "RS", i, "ReorderNum", RSPtr->reorderNum);
+  }
+  for (int i = 0; (parts & PART_BTB) && i < cfg->btbSize; i++) {
+    btbEntry *entry = &(statePtr->btBuf[i]);
+    jsonInt(fp, &first, "BT", i, "Valid", entry->valid != 0);
+    if (entry->valid) {
+      jsonInt(fp, &first, "BT", i, "BranchPC", entry->branchPC);
+      jsonStr(fp, &first, "BT", i, "BranchPred", predname[entry->branchPred]);
+      jsonInt(fp, &first, "BT", i, "BranchTarget", entry->branchTarget);
+    }
+  }
+  for (int i = 0; (parts & PART_REGS) && i < NUMREGS; i++) {
+    jsonInt(fp, &first, "R", i, "Value", regValue(statePtr, i));
+    jsonInt(fp, &first, "R", i, "Valid", statePtr->regResult[i].valid);
+    if (statePtr->regResult[i].valid == 0) {
+      jsonInt(fp, &first, "R", i, "ReorderNum", statePtr->regResult[i].reorderNum);
+    }
+  }
+  for (int i = 0; (parts & PART_MEM) && i < memCount; i++) {
+    jsonInt(fp, &first, "MEM", memFrom + i, "Value", readWord(statePtr, memFrom + i));
+  }
+  fprintf(fp, "}");
+}
+
+/*
+ * 统计写成一个 JSON 对象, 字段与参数扫描的 JSON 输出相同
+ */
+void writeJsonStats(FILE *fp, machineState *statePtr) {
+  simStats *st = &(statePtr->stats);
+  fprintf(fp, "{\"cycles\": %d, \"ipc\": %.4f", statePtr->cycles,
+          statePtr->cycles ? (double) st->instructions / statePtr->cycles : 0.0);
+  for (int k = 0; k < NUMSTATKEYS; k++) {
+    fprintf(fp, ", \"%s\": %lld", statKeys[k].column, statValue(st, k));
+  }
+  fprintf(fp, ", \"accuracy\": %.4f, \"mpki\": %.4f, \"l1hitrate\": %.4f, \"l2hitrate\": %.4f, \"avgmemlatency\": %.2f}",
+          accuracy(st), mpki(st), hitRate(st, L1), hitRate(st, L2), avgMemLatency(st));
+}
+
+/*
+ * 在快照列表末尾追加当前状态. 列表满了就把间隔加倍,
+ * 丢弃周期不是新间隔整数倍的快照 (第一份除外), 大约留下一半.
+ */
+void addSnapshot(simServer *srv) {
+  machineState *snap = newMachine(srv->statePtr->config);
+  copyMachine(snap, srv->statePtr);
+  srv->snaps[srv->numSnaps++] = snap;
+  if (srv->numSnaps == MAXSNAPS) {
+    srv->interval *= 2;
+    int kept = 1;
+    for (int i = 1; i < srv->numSnaps; i++) {
+      if (srv->snaps[i]->cycles % srv->interval == 0) {
+        srv->snaps[kept++] = srv->snaps[i];
+      } else {
+        freeMachine(srv->snaps[i]);
+      }
+    }
+    srv->numSnaps = kept;
+  }
+}
+
+/*
+ * 向前运行到周期 target, 停机或达到参数中的周期数上限时提前停止.
+ * 每个 interval 的整数倍周期都停下来, 第一次经过时保存快照.
+ */
+void serverRun(simServer *srv, int target) {
+  machineState *statePtr = srv->statePtr;
+  machineConfig *cfg = statePtr->config;
+  traceWriter none;
+  none.format = TRACE_NONE;
+  none.ckptFp = NULL;
+  if (srv->maxCycles > 0 && target > srv->maxCycles) {
+    target = srv->maxCycles;
+  }
+  while (!statePtr->halted && statePtr->cycles < target) {
+    long long next = statePtr->cycles - statePtr->cycles % srv->interval + (long long) srv->interval;
+    cfg->maxCycles = (next < target) ? next : target;
+    simulate(statePtr, &none, srv->memorySize);
+    if (statePtr->cycles % srv->interval == 0 && statePtr->cycles > srv->snaps[srv->numSnaps - 1]->cycles) {
+      addSnapshot(srv);
+    }
+  }
+  cfg->maxCycles = srv->maxCycles;
+}
+
+/*
+ * 跳到周期 target: 从不超过它的最后一份快照恢复 (当前状态更近时不恢复), 再向前运行.
+ * target 早于第一份快照时返回 -1.
+ */
+int serverSeek(simServer *srv, int target) {
+  machineState *statePtr = srv->statePtr;
+  if (target < srv->snaps[0]->cycles) {
+    return -1;
+  }
+  int lo = 0, hi = srv->numSnaps - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (srv->snaps[mid]->cycles <= target) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  if (target < statePtr->cycles || srv->snaps[lo]->cycles > statePtr->cycles) {
+    copyMachine(statePtr, srv->snaps[lo]);
+  }
+  serverRun(srv, target);
+  return 0;
+}
+
+/*
+ * 解析命令中的状态部分: rob rs btb regs mem[=FROM:COUNT] stats pages all.
+ * 出错时返回错误信息.
+ */
+char *parseParts(simServer *srv, char *token, int *parts, unsigned int *memFrom, int *memCount) {
+  int memSize = srv->statePtr->config->memSize;
+  long long space = (memSize > 0) ? memSize : 1LL << 32;
+  char *names[] = {"rob", "rs", "btb", "regs", "mem", "stats", "pages"};
+  static char error[MAXLINELENGTH];
+  for (; token != NULL; token = strtok(NULL, " \t\r\n")) {
+    int k;
+    if (strcmp(token, "all") == 0) {
+      *parts |= PART_ROB | PART_RS | PART_BTB | PART_REGS | PART_MEM | PART_STATS | PART_PAGES;
+      continue;
+    }
+    if (sscanf(token, "mem=%u:%d", memFrom, memCount) == 2) {
+      if (*memCount < 0 || *memFrom + (long long) *memCount > space) {
+        sprintf(error, "memory range %.20s is outside 0..%lld", token + 4, space - 1);
+        return error;
+      }
+      *parts |= PART_MEM;
+      continue;
+    }
+    for (k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+      if (strcmp(token, names[k]) == 0) {
+        *parts |= 1 << k;
+        break;
+      }
+    }
+    if (k == sizeof(names) / sizeof(names[0])) {
+      sprintf(error, "unknown state part %.100s", token);
+      return error;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * 出错时的回复, 错误信息中的引号和反斜杠需要转义
+ */
+void replyError(FILE *out, char *error) {
+  fprintf(out, "{\"ok\": false, \"error\": \"");
+  for (char *c = error; *c != '\0'; c++) {
+    fprintf(out, (*c == '"' || *c == '\\') ? "\\%c" : "%c", *c);
+  }
+  fprintf(out, "\"}\n");
+}
+
+/*
+ * 执行一条命令, 回复一行 JSON. 命令 (方括号内可省略):
+ *   info                       参数, 执行单元名称, 程序指令和开始的周期
+ *   state [PART...]            当前状态, 缺省为 rob rs btb regs mem
+ *   step [N] [PART...]         向前运行 N 个周期, 缺省为 1
+ *   run [CYCLE] [PART...]      运行到 CYCLE 或停机
+ *   seek CYCLE [PART...]       跳到任意周期, 可以向回跳
+ *   reset [PART...]            回到开始时的状态
+ *   quit                       结束交互模式
+ * 状态部分为 rob, rs, btb, regs, mem (程序所在的地址), mem=FROM:COUNT, stats, pages (写过的页号) 或 all.
+ * 回复总是包含 ok, cycle, pc, halted, limit 和 fault (访存错误的地址和 PC, 没有时为 null);
+ * 出错时 ok 为 false, error 为错误信息, 状态不变.
+ * 返回 1 表示收到了 quit.
+ */
+int serveCommand(simServer *srv, char *line, FILE *out) {
+  machineState *statePtr = srv->statePtr;
+  machineConfig *cfg = statePtr->config;
+  char *command = strtok(line, " \t\r\n");
+  char *token = strtok(NULL, " \t\r\n");
+  char *error = NULL;
+  int parts = 0;
+  unsigned int memFrom = 0;
+  int memCount = srv->memorySize;
+  int value = -1;
+  char *end;
+
+  if (command == NULL) {
+    return 0;
+  }
+  // 可选的周期参数
+  if (token != NULL) {
+    long v = strtol(token, &end, 10);
+    if (*end == '\0') {
+      if (v < 0 || v > INT_MAX) {
+        error = "cycle out of range";
+      }
+      value = v;
+      token = strtok(NULL, " \t\r\n");
+    }
+  }
+  if (error == NULL) {
+    error = parseParts(srv, token, &parts, &memFrom, &memCount);
+  }
+  if (error != NULL) {
+    replyError(out, error);
+    return 0;
+  }
+  if (strcmp(command, "info") == 0) {
+    fprintf(out, "{\"ok\": true, \"first\": %d, \"rbSize\": %d, \"numUnits\": %d, \"btbSize\": %d, ",
+            srv->snaps[0]->cycles, cfg->rbSize, cfg->numUnits, cfg->btbSize);
+    fprintf(out, "\"numRegs\": %d, \"memSize\": %d, \"memorySize\": %d, \"units\": [",
+            NUMREGS, cfg->memSize, srv->memorySize);
+    for (int i = 0; i < cfg->numUnits; i++) {
+      fprintf(out, "%s\"%s\"", i ? ", " : "", cfg->unitname[i]);
+    }
+    fprintf(out, "], \"instr\": [");
+    for (int i = 16; i < srv->memorySize; i++) {
+      fprintf(out, "%s%d", (i > 16) ? ", " : "", readWord(srv->snaps[0], i));
+    }
+    fprintf(out, "]}\n");
+    return 0;
+  } else if (strcmp(command, "quit") == 0) {
+    fprintf(out, "{\"ok\": true}\n");
+    return 1;
+  } else if (strcmp(command, "state") == 0) {
+    if (parts == 0) {
+      parts = PART_ROB | PART_RS | PART_BTB | PART_REGS | PART_MEM;
+    }
+  } else if (strcmp(command, "step") == 0) {
+    int n = (value < 0) ? 1 : value;
+    serverRun(srv, (n > INT_MAX - statePtr->cycles) ? INT_MAX : statePtr->cycles + n);
+  } else if (strcmp(command, "run") == 0) {
+    serverRun(srv, (value < 0) ? INT_MAX : value);
+  } else if (strcmp(command, "seek") == 0) {
+    if (value < 0) {
+      error = "seek needs a cycle";
+    } else if (serverSeek(srv, value) < 0) {
+      error = "cycle is before the first cycle";
+    }
+  } else if (strcmp(command, "reset") == 0) {
+    copyMachine(statePtr, srv->snaps[0]);
+  } else {
+    error = "unknown command";
+  }
+  if (error != NULL) {
+    replyError(out, error);
+    return 0;
+  }
+  fprintf(out, "{\"ok\": true, \"cycle\": %d, \"pc\": %d, \"halted\": %s, \"limit\": %s", statePtr->cycles,
+          statePtr->pc, statePtr->halted ? "true" : "false",
+          (srv->maxCycles > 0 && statePtr->cycles >= srv->maxCycles) ? "true" : "false");
+  if (statePtr->fault) {
+    fprintf(out, ", \"fault\": {\"address\": %u, \"pc\": %d}", statePtr->faultAddress, statePtr->faultPC);
+  } else {
+    fprintf(out, ", \"fault\": null");
+  }
+  if (parts & ~(PART_STATS | PART_PAGES)) {
+    fprintf(out, ", \"state\": ");
+    writeJsonState(out, statePtr, parts, memFrom, memCount);
+  }
+  if (parts & PART_STATS) {
+    fprintf(out, ", \"stats\": ");
+    writeJsonStats(out, statePtr);
+  }
+  if (parts & PART_PAGES) {
+    fprintf(out, ", \"pages\": [");
+    for (int i = 0; i < statePtr->memory->numDirty; i++) {
+      fprintf(out, "%s%u", i ? ", " : "", statePtr->memory->dirty[i]->number);
+    }
+    fprintf(out, "]");
+  }
+  fprintf(out, "}\n");
+  return 0;
+}
 
-    /*
-     * 基本要求:
-     * 首先, 确定是否需要清空流水线或提交位于 ROB 的队首的指令.
-     * 我们处理分支跳转的缺省方法是假设跳转不成功, 如果我们的预测是错误的,
-     * 就需要清空流水线(ROB/保留站/寄存器状态), 设置新的 PC = 跳转目标.
-     * 如果不需要清空, 并且队首指令能够提交, 在这里更新状态:
-     *     对寄存器访问, 修改寄存器;
-     *     对内存写操作, 修改内存.
-     * 在完成清空或提交操作后, 不要忘了释放保留站并更新队列的首指针.
-     */
-    if (statePtr->reorderBuf[headRB].busy && statePtr->reorderBuf[headRB].instrStatus == COMMITTING) {
-      int instr = statePtr->reorderBuf[headRB].instr;
-      if (opcode(instr) == BEQZ) {
-        /*
-         * 选作内容:
-         * 在提交的时候, 我们知道跳转指令的最终结果.
-         * 有三种可能的情况: 预测跳转成功, 预测跳转不成功, 不能预测(因为分支预测缓冲栈中没有对应的项目).
-         * 如果我们预测跳转成功:
-         *     如果我们的预测是正确的, 只需要继续执行就可以了;
-         *     如果我们的预测是错误的, 即实际没有发生跳转, 就必须重新设置正确的PC值, 并清空流水线.
-         * 如果我们预测跳转不成功:
-         *     如果预测是正确的, 继续执行;
-         *     如果预测是错误的, 即实际上发生了跳转, 就必须将PC设置为跳转目标, 并清空流水线.
-         * 如果我们不能预测跳转是否成功:
-         *     如果跳转成功, 仍然需要清空流水线, 将PC修改为跳转目标.
-         * 在遇到分支时, 需要更新分支预测缓冲站的内容.
-         */
-        for (int i = 0; i < BTBSIZE; i++) {
-          if (statePtr->btBuf[i].valid == 1 && statePtr->btBuf[i].branchPC == statePtr->reorderBuf[headRB].branchPC) {
-            if (statePtr->reorderBuf[headRB].branchCmp == 1) {  // 发生跳转
-              switch (statePtr->btBuf[i].branchPred) {
-                case STRONGNOT:  // 预测错误
-                  statePtr->btBuf[i].branchPred = WEAKNOT;
-                  // 设置跳转地址
-                  statePtr->pc = statePtr->reorderBuf[headRB].result;
-                  // 清空 ROB
-                  for (int i = 0; i < RBSIZE; i++) {
-                    statePtr->reorderBuf[i].busy = 0;
-                  }
-                  // 清空保留站
-                  for (int i = 0; i < NUMUNITS; i++) {
-                    statePtr->reservation[i].busy = 0;
-                  }
-                  // 清空寄存器状态
-                  for (int i = 0; i < NUMREGS; i++) {
-                    statePtr->regResult[i].valid = 1;
-                  }
-                  // 更新队列的首指针
-                  headRB = -1;
-                  tailRB = -1;
-                  break;
-                case WEAKNOT:  // 预测错误
-                  statePtr->btBuf[i].branchPred = WEAKTAKEN;
-                  statePtr->btBuf[i].branchTarget = statePtr->reorderBuf[headRB].result;
-                  // 设置跳转地址
-                  statePtr->pc = statePtr->reorderBuf[headRB].result;
-                  // 清空 ROB
-                  for (int i = 0; i < RBSIZE; i++) {
-                    statePtr->reorderBuf[i].busy = 0;
-                  }
-                  // 清空保留站
-                  for (int i = 0; i < NUMUNITS; i++) {
-                    statePtr->reservation[i].busy = 0;
-                  }
-                  // 清空寄存器状态
-                  for (int i = 0; i < NUMREGS; i++) {
-                    statePtr->regResult[i].valid = 1;
-                  }
-                  // 更新队列的首指针
-                  headRB = -1;
-                  tailRB = -1;
-                  break;
-                case WEAKTAKEN:  // 预测正确
-                  statePtr->btBuf[i].branchPred = STRONGTAKEN;
-                  // 释放保留站
-                  statePtr->reorderBuf[headRB].busy = 0;
-                  // 更新队列的首指针
-                  headRB = (headRB + 1) % RBSIZE;
-                  break;
-                default:  // 预测正确
-                  // 释放保留站
-                  statePtr->reorderBuf[headRB].busy = 0;
-                  // 更新队列的首指针
-                  headRB = (headRB + 1) % RBSIZE;
-                  break;
-              }
-            } else {
-                switch (statePtr->btBuf[i].branchPred) {  // 不发生跳转
-                  case STRONGNOT:  // 预测正确
-                    // 释放保留站
-                    statePtr->reorderBuf[headRB].busy = 0;
-                    // 更新队列的首指针
-                    headRB = (headRB + 1) % RBSIZE;
-                    break;
-                  case WEAKNOT:  // 预测正确
-                    statePtr->btBuf[i].branchPred = STRONGNOT;
-                    // 释放保留站
-                    statePtr->reorderBuf[headRB].busy = 0;
-                    // 更新队列的首指针
-                    headRB = (headRB + 1) % RBSIZE;
-                    break;
-                  case WEAKTAKEN:  // 预测错误
-                    statePtr->btBuf[i].branchPred = WEAKNOT;
-                    // 设置跳转地址
-                    statePtr->pc = statePtr->reorderBuf[headRB].branchPC + 1;
-                    // 清空 ROB
-                    for (int i = 0; i < RBSIZE; i++) {
-                      statePtr->reorderBuf[i].busy = 0;
-                    }
-                    // 清空保留站
-                    for (int i = 0; i < NUMUNITS; i++) {
-                      statePtr->reservation[i].busy = 0;
-                    }
-                    // 清空寄存器状态
-                    for (int i = 0; i < NUMREGS; i++) {
-                      statePtr->regResult[i].valid = 1;
-                    }
-                    // 更新队列的首指针
-                    headRB = -1;
-                    tailRB = -1;
-                    break;
-                  default:  // 预测错误
-                    statePtr->btBuf[i].branchPred = WEAKTAKEN;
-                    // 设置跳转地址
-                    statePtr->pc = statePtr->reorderBuf[headRB].branchPC + 1;
-                    // 清空 ROB
-                    for (int i = 0; i < RBSIZE; i++) {
-                      statePtr->reorderBuf[i].busy = 0;
-                    }
-                    // 清空保留站
-                    for (int i = 0; i < NUMUNITS; i++) {
-                      statePtr->reservation[i].busy = 0;
-                    }
-                    // 清空寄存器状态
-                    for (int i = 0; i < NUMREGS; i++) {
-                      statePtr->regResult[i].valid = 1;
-                    }
-                    // 更新队列的首指针
-                    headRB = -1;
-                    tailRB = -1;
-                    break;
-                }
-            }
-            break;
-          }
+/*
+ * 从 in 逐行读命令并回复到 out, 直到输入结束或收到 quit. 收到 quit 时返回 1.
+ */
+int serveStream(simServer *srv, FILE *in, FILE *out) {
+  char line[MAXLINELENGTH];
+  while (fgets(line, MAXLINELENGTH, in) != NULL) {
+    int quit = serveCommand(srv, line, out);
+    fflush(out);
+    if (quit) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * 交互模式. socketPath 为 NULL 时使用标准输入输出,
+ * 否则在该路径上监听 Unix socket, 依次为每个连接服务, 直到某个连接发出 quit.
+ */
+void serve(machineState *statePtr, int memorySize, int interval, char *socketPath) {
+  simServer srv;
+  srv.statePtr = statePtr;
+  srv.memorySize = memorySize;
+  srv.interval = interval;
+  srv.maxCycles = statePtr->config->maxCycles;
+  srv.snaps = (machineState **) malloc(MAXSNAPS * sizeof(machineState *));
+  srv.numSnaps = 0;
+  addSnapshot(&srv);
+  if (socketPath == NULL) {
+    serveStream(&srv, stdin, stdout);
+    return;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+    printf("error: socket path %s is too long\n", socketPath);
+    exit(1);
+  }
+  strcpy(addr.sun_path, socketPath);
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketPath);
+  if (listenFd < 0 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listenFd, 1) < 0) {
+    printf("error: can't listen on %s", socketPath);
+    perror("socket");
+    exit(1);
+  }
+  signal(SIGPIPE, SIG_IGN);  // 客户端提前断开时只结束这个连接
+  int quit = 0;
+  while (!quit) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    quit = serveStream(&srv, in, out);
+    fclose(in);
+    fclose(out);
+  }
+  close(listenFd);
+  unlink(socketPath);
+}
+
+int main(int argc, char *argv[]) {
+  FILE *filePtr;
+  machineState *statePtr;
+  program *prog;
+  int memorySize;
+  traceWriter trace;
+  char *tracePath = NULL;
+  char *indexPath = NULL;
+  int opt;
+  machineConfig config;
+  machineConfig *cfg = &config;
+  char *sweepPath = NULL;
+  int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int sweepJson = 0;
+  char *reportPath = NULL;
+  char *ckptPath = NULL;
+  int ckptInterval = 0;
+  char *loadPath = NULL;
+  int seekCycle = -1;
+  int serverMode = 0;
+  char *socketPath = NULL;
+
+  /*
+   * 解析命令行参数:
+   *   -f text|bin  状态输出格式, 缺省为二进制
+   *   -k N         二进制格式的关键帧间隔
+   *   -o FILE      状态输出文件, 缺省为标准输出
+   *   -i FILE      周期索引文件, 缺省为 FILE.idx (仅在指定 -o 时)
+   *   -q           快速模式, 不输出逐周期状态, 停机时输出结果和统计
+   *   -c FILE      读取机器参数配置文件 (每行 key = value)
+   *   -p KEY=VALUE 设置一个机器参数, 在配置文件之后生效
+   *   -s FILE      参数扫描, 文件每行为 "key=v1,v2,... key=...", 展开成所有组合
+   *   -j N         参数扫描使用的线程数, 缺省为 CPU 数
+   *   -J           参数扫描结果输出为 JSON, 缺省为 CSV
+   *   -r FILE      停机时把周期分类, 保留站占用率和 ROB 占用直方图以 JSON 格式写入 FILE
+   *   -w FILE      运行时每隔一段周期把机器状态作为检查点写入 FILE
+   *   -W N         检查点间隔, 缺省为 CKPTINTERVAL 个周期; 交互模式下为最初的内存快照间隔, 缺省为 SNAPINTERVAL
+   *   -l FILE      从检查点文件 FILE 恢复后继续运行, 参数和程序必须与写检查点时相同
+   *   -g CYCLE     与 -l 一起使用: 从不超过 CYCLE 的最后一个检查点恢复, 不输出状态地运行到 CYCLE,
+   *                再从这里开始输出. 缺省从最后一个检查点开始
+   *   -S           交互模式: 从标准输入读命令, 每条命令在标准输出回复一行 JSON (见 serveCommand)
+   *   -U SOCKET    交互模式, 命令和回复通过 Unix socket SOCKET 传递
+   * 可用的参数名见 configKeys
+   */
+  defaultConfig(cfg);
+  trace.format = TRACE_BINARY;
+  trace.interval = KEYFRAMEINTERVAL;
+  while ((opt = getopt(argc, argv, "f:k:o:i:qc:p:s:j:Jr:w:W:l:g:SU:")) != -1) {
+    switch (opt) {
+      case 'f':
+        if (strcmp(optarg, "text") == 0) {
+          trace.format = TRACE_TEXT;
+        } else if (strcmp(optarg, "bin") == 0) {
+          trace.format = TRACE_BINARY;
+        } else {
+          printf("error: unknown trace format %s\n", optarg);
+          exit(1);
         }
-      } else if (opcode(instr) == J) {
-        // 设置跳转地址
-        statePtr->pc = statePtr->reorderBuf[headRB].result;
-        // 清空 ROB
-        for (int i = 0; i < RBSIZE; i++) {
-          statePtr->reorderBuf[i].busy = 0;
+        break;
+      case 'k':
+        trace.interval = atoi(optarg);
+        if (trace.interval <= 0) {
+          printf("error: keyframe interval must be positive\n");
+          exit(1);
         }
-        // 清空保留站
-        for (int i = 0; i < NUMUNITS; i++) {
-          statePtr->reservation[i].busy = 0;
+        break;
+      case 'o':
+        tracePath = optarg;
+        break;
+      case 'i':
+        indexPath = optarg;
+        break;
+      case 'q':
+        trace.format = TRACE_NONE;
+        break;
+      case 'c':
+        readConfig(cfg, optarg);
+        break;
+      case 'p':
+        if (parseConfigLine(cfg, optarg) != 0) {
+          printf("error: bad parameter %s\n", optarg);
+          exit(1);
         }
-        // 清空寄存器状态
-        for (int i = 0; i < NUMREGS; i++) {
-          statePtr->regResult[i].valid = 1;
+        break;
+      case 's':
+        sweepPath = optarg;
+        break;
+      case 'j':
+        numThreads = atoi(optarg);
+        if (numThreads <= 0) {
+          printf("error: thread count must be positive\n");
+          exit(1);
         }
-        // 更新队列的首指针
-        headRB = -1;
-        tailRB = -1;
-      } else if (opcode(instr) == HALT) {
-        // 释放保留站, 更新队列的首指针
-        headRB = (headRB + 1) % RBSIZE;
-        // 停机
         break;
-      } else if (opcode(instr) == NOOP) {
-        // 释放保留站
-        statePtr->reorderBuf[headRB].busy = 0;
-        // 更新队列的首指针
-        headRB = (headRB + 1) % RBSIZE;
-        // 不进行操作
-      } else {
-        if (opcode(instr) == SW) {  // 修改内存
-          int storeAddress = statePtr->reorderBuf[headRB].storeAddress;
-          if (statePtr->reorderBuf[headRB].valid == 1) {
-            statePtr->memory[storeAddress] = statePtr->reorderBuf[headRB].result;
-          }
-        } else {  // 修改寄存器
-          int rd = (opcode(instr) == regRegALU) ? field2(instr) : field1(instr);
-          if (!statePtr->regResult[rd].valid && statePtr->regResult[rd].reorderNum == headRB) {
-            if (statePtr->reorderBuf[headRB].valid == 1) {
-              statePtr->regFile[rd] = statePtr->reorderBuf[headRB].result;
-            }
-            statePtr->regResult[rd].valid = 1;
-          }
+      case 'J':
+        sweepJson = 1;
+        break;
+      case 'r':
+        reportPath = optarg;
+        break;
+      case 'w':
+        ckptPath = optarg;
+        break;
+      case 'W':
+        ckptInterval = atoi(optarg);
+        if (ckptInterval <= 0) {
+          printf("error: checkpoint interval must be positive\n");
+          exit(1);
         }
-        // 释放保留站
-        statePtr->reorderBuf[headRB].busy = 0;
-        // 更新队列的首指针
-        headRB = (headRB + 1) % RBSIZE;
-      }
-    }   
-
-    /*
-     * 提交完成.
-     * 检查所有保留站中的指令, 对下列状态, 分别完成所需的操作:
-     */
-    int RBNum = (headRB <= tailRB) ? tailRB - headRB + 1 : RBSIZE + tailRB - headRB + 1;
-    if (headRB == -1 && tailRB == -1) {
-      RBNum = 0;
-      headRB = 0;
-    }
-    for (int i = headRB; i < headRB + RBNum; i++) {
-      reorderEntry *RBPtr = &(statePtr->reorderBuf[i % RBSIZE]);
-      if (RBPtr->busy == 1) {
-        resStation *execUnit = &(statePtr->reservation[RBPtr->execUnit]);
-        if (RBPtr->instrStatus == ISSUING) {
-          /*
-           * 对 Issuing 状态:
-           * 检查两个操作数是否都已经准备好, 如果是, 将指令状态修改为 Executing
-           */
-          if (execUnit->busy == 1) {
-            if (execUnit->Qj == -1 && execUnit->Qk == -1) {
-              RBPtr->instrStatus = EXECUTING;
-            }
-          }
-        } else if (RBPtr->instrStatus == EXECUTING) {
-          /*
-           * 对 Executing 状态:
-           * 执行剩余时间递减;
-           * 在执行完成时, 将指令状态修改为 Writing Result
-           */
-          if (execUnit->busy == 1) {
-            execUnit->exTimeLeft--;
-            if (execUnit->exTimeLeft == 0) {
-              RBPtr->instrStatus = WRITINGRESULT;
-            }
-          }
-        } else if (RBPtr->instrStatus == WRITINGRESULT) {
-          /* 
-           * 对 Writing Result 状态:
-           * 将结果复制到正在等待该结果的其他保留站中去;
-           * 还需要将结果保存在 ROB 中的临时存储区中.
-           * 释放指令占用的保留站, 将指令状态修改为 Committing
-           */
-          // 计算结果
-          int result = 0;
-          switch (opcode(execUnit->instr)) {
-            case LW:
-              result = statePtr->memory[execUnit->Vj + immediate(execUnit->instr)];
-              break;
-            case SW:
-              result = execUnit->Vk;
-              RBPtr->storeAddress = execUnit->Vj + immediate(execUnit->instr);
-              break;
-            case regRegALU:
-              switch (func(execUnit->instr)) {
-                case addFunc:
-                  result = execUnit->Vj + execUnit->Vk;
-                  break;
-                case subFunc:
-                  result = execUnit->Vj - execUnit->Vk;
-                  break;
-                default:
-                  result = execUnit->Vj & execUnit->Vk;
-                  break;
-              }
-              break;
-            case ADDI:
-              result = execUnit->Vj + immediate(execUnit->instr);
-              break;
-            case ANDI:
-              result = execUnit->Vj & immediate(execUnit->instr);
-              break;
-            case BEQZ:
-              result = execUnit->Vk + immediate(execUnit->instr);
-              RBPtr->branchCmp = (execUnit->Vj == 0) ? 1 : 0;
-              break;
-            case J:
-              result = execUnit->Vk + immediate(execUnit->instr);
-              break;
-            default:
-              break;
-          }
-          // 写回 ROB
-          RBPtr->valid = 1;
-          RBPtr->result = result;
-          // 更新保留站
-          for (int i = 0; i < NUMUNITS; i++) {
-            if (statePtr->reservation[i].busy) {
-              if (statePtr->reservation[i].Qj == execUnit->reorderNum) {
-                statePtr->reservation[i].Qj = -1;
-                statePtr->reservation[i].Vj = result;
-              }
-              if (statePtr->reservation[i].Qk == execUnit->reorderNum) {
-                statePtr->reservation[i].Qk = -1;
-                statePtr->reservation[i].Vk = result;
-              }
-            }
-          }
-          // 释放保留站
-          execUnit->busy = 0;
-          RBPtr->instrStatus = COMMITTING;
+        break;
+      case 'l':
+        loadPath = optarg;
+        break;
+      case 'g':
+        seekCycle = atoi(optarg);
+        if (seekCycle < 0) {
+          printf("error: cycle must not be negative\n");
+          exit(1);
         }
-      }
+        break;
+      case 'S':
+        serverMode = 1;
+        break;
+      case 'U':
+        serverMode = 1;
+        socketPath = optarg;
+        break;
+      default:
+        optind = argc;
+        break;
     }
+  }
+  if (argc - optind != 1) {
+    printf("error: usage: %s [-q] [-c config] [-p key=value] [-f text|bin] [-k interval] [-o trace file] [-i index file] [-r report file] [-w checkpoint file [-W interval]] [-l checkpoint file [-g cycle]] [-S | -U socket] [-s sweep file [-j threads] [-J]] <machine-code file>\n", argv[0]);
+    exit(1);
+  }
+  if (seekCycle >= 0 && loadPath == NULL) {
+    printf("error: -g needs a checkpoint file (-l)\n");
+    exit(1);
+  }
+  if (serverMode && (sweepPath != NULL || ckptPath != NULL)) {
+    printf("error: interactive mode can't be combined with -s or -w\n");
+    exit(1);
+  }
 
-    /*
-     * 最后, 当我们处理完了保留站中的所有指令后, 检查是否能够发射一条新的指令.
-     * 首先检查 ROB 中是否有空闲的空间,
-     * 如果有，再检查所需运算单元是否有空闲的保留站,
-     * 如果有, 发射指令.
-     * 
-     * 在ROB的队尾检查是否有空闲的空间,
-     * ROB是一个循环队列, 它可以容纳 RBSIZE 个项目.
-     * 新的指令被添加到队列的末尾, 指令提交则是从队首进行的.
-     * 当队列的首指针或尾指针到达数组中的最后一项时, 它应滚动到数组的第一项.
-     * 
-     * 发射指令:
-     * 填写保留站和 ROB 项的内容.
-     * 注意, 要在所有的字段中写入正确的值.
-     * 检查寄存器状态, 相应的在 Vj,Vk 和 Qj,Qk 字段中设置正确的值:
-     * 对于 I 类型指令, 设置 Qk=0,Vk=0;
-     * 对于 SW 指令, 如果寄存器有效, 将寄存器中的内存基地址保存在 Vj 中;
-     * 对于 BEQZ 和 J 指令, 将当前 PC+1 的值保存在 Vk 字段中.
-     * 如果指令在提交时会修改寄存器的值, 还需要在这里更新寄存器状态数据结构.
-     */
-    if (RBNum < RBSIZE) {
-      if (statePtr->pc < memorySize) {
-        int instr = statePtr->memory[statePtr->pc];
-        if (opcode(instr) == regRegALU) {  // R 型指令
-          if (!statePtr->reservation[INT1].busy || !statePtr->reservation[INT2].busy) {
-            int execUnit = (statePtr->reservation[INT1].busy == 1) ? INT2 : INT1;
-            // 提交到 ROB
-            tailRB = (tailRB + 1) % RBSIZE;
-            statePtr->reorderBuf[tailRB].busy = 1;
-            statePtr->reorderBuf[tailRB].instr = instr;
-            statePtr->reorderBuf[tailRB].execUnit = execUnit;
-            statePtr->reorderBuf[tailRB].instrStatus = ISSUING;
-            statePtr->reorderBuf[tailRB].valid = 0;
-            // 提交到保留站
-            statePtr->reservation[execUnit].busy = 1;
-            statePtr->reservation[execUnit].instr = instr;
-            // Vj, Qj
-            int rs1 = field0(instr);
-            if (statePtr->regResult[rs1].valid == 1) {
-              statePtr->reservation[execUnit].Vj = statePtr->regFile[rs1];
-              statePtr->reservation[execUnit].Qj = -1;
-            } else {
-              if (statePtr->reorderBuf[statePtr->regResult[rs1].reorderNum].instrStatus == COMMITTING) {
-                statePtr->reservation[execUnit].Vj = statePtr->reorderBuf[statePtr->regResult[rs1].reorderNum].result;
-                statePtr->reservation[execUnit].Qj = -1;
-              } else {
-                statePtr->reservation[execUnit].Qj = statePtr->regResult[rs1].reorderNum;
-              }
-            }
-            // Vk, Qk
-            int rs2 = field1(instr);
-            if (statePtr->regResult[rs2].valid == 1) {
-              statePtr->reservation[execUnit].Vk = statePtr->regFile[rs2];
-              statePtr->reservation[execUnit].Qk = -1;
-            } else {
-              if (statePtr->reorderBuf[statePtr->regResult[rs2].reorderNum].instrStatus == COMMITTING) {
-                statePtr->reservation[execUnit].Vk = statePtr->reorderBuf[statePtr->regResult[rs2].reorderNum].result;
-                statePtr->reservation[execUnit].Qk = -1;
-              } else {
-                statePtr->reservation[execUnit].Qk = statePtr->regResult[rs2].reorderNum;
-              }
-            }
-            statePtr->reservation[execUnit].exTimeLeft = 1;
-            statePtr->reservation[execUnit].reorderNum = tailRB;
-            // 更新寄存器状态
-            int rd = field2(instr);
-            statePtr->regResult[rd].valid = 0;
-            statePtr->regResult[rd].reorderNum = tailRB;
-            // 更新 PC
-            statePtr->pc++;
-          }
-        } else if (opcode(instr) == ADDI || opcode(instr) == ANDI || opcode(instr) == BEQZ ||
-                  opcode(instr) == LW || opcode(instr) == SW) {  // I 型指令
-          int execUnit = -1;
-          if (opcode(instr) == ADDI || opcode(instr) == ANDI || opcode(instr) == BEQZ) {  // ADDI, ANDI, BEQZ 
-            if (!statePtr->reservation[INT1].busy || !statePtr->reservation[INT2].busy) {
-              execUnit = (statePtr->reservation[INT1].busy == 1) ? INT2 : INT1;
-            }
-          } else if (opcode(instr) == LW) {  // LW
-            if (!statePtr->reservation[LOAD1].busy || !statePtr->reservation[LOAD2].busy) {
-              execUnit = (statePtr->reservation[LOAD1].busy == 1) ? LOAD2 : LOAD1;
-            }
-          } else {  // SW
-            if (!statePtr->reservation[STORE1].busy || !statePtr->reservation[STORE2].busy) {
-              execUnit = (statePtr->reservation[STORE1].busy == 1) ? STORE2 : STORE1;
-            }
-          }
-          if (execUnit != -1) {
-            // 提交到 ROB
-            tailRB = (tailRB + 1) % RBSIZE;
-            statePtr->reorderBuf[tailRB].busy = 1;
-            statePtr->reorderBuf[tailRB].instr = instr;
-            statePtr->reorderBuf[tailRB].execUnit = execUnit;
-            statePtr->reorderBuf[tailRB].instrStatus = ISSUING;
-            statePtr->reorderBuf[tailRB].valid = 0;
-            if (opcode(instr) == BEQZ) {
-              statePtr->reorderBuf[tailRB].branchPC = statePtr->pc;
-            }
-            // 提交到保留站
-            statePtr->reservation[execUnit].busy = 1;
-            statePtr->reservation[execUnit].instr = instr;
-            // Vj, Qj
-            int rs1 = field0(instr);
-            if (statePtr->regResult[rs1].valid == 1) {
-              statePtr->reservation[execUnit].Vj = statePtr->regFile[rs1];
-              statePtr->reservation[execUnit].Qj = -1;
-            } else {
-              if (statePtr->reorderBuf[statePtr->regResult[rs1].reorderNum].instrStatus == COMMITTING) {
-                statePtr->reservation[execUnit].Vj = statePtr->reorderBuf[statePtr->regResult[rs1].reorderNum].result;
-                statePtr->reservation[execUnit].Qj = -1;
-              } else {
-                statePtr->reservation[execUnit].Qj = statePtr->regResult[rs1].reorderNum;
-              }
-            }
-            // Vk, Qk
-            if (opcode(instr) == BEQZ) {
-              statePtr->reservation[execUnit].Vk = statePtr->pc + 1;
-              statePtr->reservation[execUnit].Qk = -1;
-            } else if (opcode(instr) == SW) {
-              int rd = field1(instr);
-              if (statePtr->regResult[rd].valid == 1) {
-                statePtr->reservation[execUnit].Vk = statePtr->regFile[rd];
-                statePtr->reservation[execUnit].Qk = -1;
-              } else {
-                if (statePtr->reorderBuf[statePtr->regResult[rd].reorderNum].instrStatus == COMMITTING) {
-                  statePtr->reservation[execUnit].Vk = statePtr->reorderBuf[statePtr->regResult[rd].reorderNum].result;
-                  statePtr->reservation[execUnit].Qk = -1;
-                } else {
-                  statePtr->reservation[execUnit].Qk = statePtr->regResult[rd].reorderNum;
-                }
-              }
-            } else {
-              statePtr->reservation[execUnit].Vk = 0;
-              statePtr->reservation[execUnit].Qk = -1;
-            }
-            if (opcode(instr) == ADDI || opcode(instr) == ANDI) {  // ADDI, ANDI
-              statePtr->reservation[execUnit].exTimeLeft = 1;
-            } else if (opcode(instr) == LW || opcode(instr) == SW) {  // LW, SW
-              statePtr->reservation[execUnit].exTimeLeft = 2;
-            } else {  // BEQZ
-              statePtr->reservation[execUnit].exTimeLeft = 3;
-            }
-            statePtr->reservation[execUnit].reorderNum = tailRB;
-            // 更新寄存器状态
-            if (opcode(instr) == ADDI || opcode(instr) == ANDI || opcode(instr) == LW) {
-              int rd = field1(instr);
-              statePtr->regResult[rd].valid = 0;
-              statePtr->regResult[rd].reorderNum = tailRB;
-            }
-            /*
-             * 选作内容:
-             * 在发射跳转指令时, 将PC修改为正确的目标: 是pc = pc+1, 还是pc = 跳转目标?
-             * 在发射其他的指令时, 只需要设置pc = pc+1.
-             */
-            if (opcode(instr) == BEQZ) {
-              int isCached = 0;
-              for (int i = 0; i < BTBSIZE; i++) {
-                if (statePtr->btBuf[i].branchPC == statePtr->pc) {
-                  isCached = 1;
-                  if (statePtr->btBuf[i].branchPred == STRONGTAKEN || statePtr->btBuf[i].branchPred == WEAKTAKEN) {
-                    statePtr->pc = statePtr->btBuf[i].branchTarget;
-                  } else {
-                    statePtr->pc++;
-                  }
-                  break;
-                }
-              }
-              if (isCached == 0) {
-                int isFull = 1;
-                // 更新 BTB
-                for (int i = 0; i < BTBSIZE; i++) {
-                  if (statePtr->btBuf[i].valid == 0) {
-                    isFull = 0;
-                    statePtr->btBuf[i].valid = 1;
-                    statePtr->btBuf[i].branchPC = statePtr->pc;
-                    statePtr->btBuf[i].branchPred = STRONGNOT;
-                    statePtr->btBuf[i].branchTarget = statePtr->pc + 1;
-                    break;
-                  }
-                }
-                // 如果缓冲栈已满
-                if (isFull == 1) {
-                  int rand = statePtr->cycles % BTBSIZE;
-                  statePtr->btBuf[rand].valid = 1;
-                  statePtr->btBuf[rand].branchPC = statePtr->pc;
-                  statePtr->btBuf[rand].branchPred = STRONGNOT;
-                  statePtr->btBuf[rand].branchTarget = statePtr->pc + 1;
-                }
-                // 更新 PC
-                statePtr->pc++;
-              }
-            } else {
-              statePtr->pc++;
-            }
-          }
-        } else {  // J 型指令
-          if (!statePtr->reservation[INT1].busy || !statePtr->reservation[INT2].busy) {
-            int execUnit = (statePtr->reservation[INT1].busy == 1) ? INT2 : INT1;
-            // 提交到 ROB
-            tailRB = (tailRB + 1) % RBSIZE;
-            statePtr->reorderBuf[tailRB].busy = 1;
-            statePtr->reorderBuf[tailRB].instr = instr;
-            statePtr->reorderBuf[tailRB].execUnit = execUnit;
-            statePtr->reorderBuf[tailRB].instrStatus = ISSUING;
-            statePtr->reorderBuf[tailRB].valid = 0;
-            // 提交到保留站
-            statePtr->reservation[execUnit].busy = 1;
-            statePtr->reservation[execUnit].instr = instr;
-            // Vk, Qk
-            statePtr->reservation[execUnit].Vk = statePtr->pc + 1;
-            statePtr->reservation[execUnit].Qk = -1;
-            statePtr->reservation[execUnit].exTimeLeft = 1;
-            statePtr->reservation[execUnit].reorderNum = tailRB;
-            // 更新 PC
-            statePtr->pc++;
-          }
-        }
-      }
+  /*
+   * 初始化, 读输入文件等
+   */
+  filePtr = fopen(argv[optind], "r");
+  if (filePtr == NULL) {
+    printf("error: can't open file %s", argv[optind]);
+    perror("fopen");
+    exit(1);
+  }
+  if (tracePath != NULL && freopen(tracePath, "w", stdout) == NULL) {
+    printf("error: can't open file %s", tracePath);
+    perror("freopen");
+    exit(1);
+  }
+  if (sweepPath != NULL) {
+    sweepJob *jobs;
+    int numJobs = readSweep(cfg, sweepPath, &jobs);
+    prog = loadProgram(filePtr, 0);
+    fclose(filePtr);
+    runSweep(jobs, numJobs, prog, numThreads);
+    printSweep(jobs, numJobs, sweepJson);
+    return 0;
+  }
+  trace.fp = stdout;
+  trace.indexFp = NULL;
+  if (indexPath == NULL && tracePath != NULL && trace.format != TRACE_NONE) {
+    indexPath = (char *) malloc(strlen(tracePath) + 5);
+    sprintf(indexPath, "%s.idx", tracePath);
+  }
+  if (indexPath != NULL) {
+    trace.indexFp = fopen(indexPath, "wb");
+    if (trace.indexFp == NULL) {
+      printf("error: can't open file %s", indexPath);
+      perror("fopen");
+      exit(1);
     }
-	    
-    /*
-    * 周期计数加1
-    */
-    statePtr->cycles++;
-  }  /* while (1) */
-	// printf("halting machine\n");
-  printFileState(statePtr, memorySize);
+  }
+
+  /*
+   * 分配数据结构空间
+   */
+  if (configError(cfg) != NULL) {
+    printf("error: %s\n", configError(cfg));
+    exit(1);
+  }
+  finishConfig(cfg);
+  statePtr = newMachine(cfg);
+
+  prog = loadProgram(filePtr, cfg->memSize);
+  fclose(filePtr);
+  memorySize = prog->size;
+  initMachine(statePtr, prog);
 
-  printf("%d", statePtr->cycles);
+  /*
+   * 从检查点恢复, 并准备写检查点
+   */
+  if (loadPath != NULL) {
+    FILE *loadFp = fopen(loadPath, "rb");
+    if (loadFp == NULL) {
+      printf("error: can't open file %s", loadPath);
+      perror("fopen");
+      exit(1);
+    }
+    if (seekMachine(loadFp, statePtr, memorySize, seekCycle) < 0) {
+      printf("error: no checkpoint in %s at or before cycle %d\n", loadPath, seekCycle < 0 ? 0 : seekCycle);
+      exit(1);
+    }
+    fclose(loadFp);
+  }
+  trace.ckptFp = NULL;
+  if (ckptPath != NULL) {
+    trace.ckptFp = fopen(ckptPath, "wb");
+    if (trace.ckptFp == NULL) {
+      printf("error: can't open file %s", ckptPath);
+      perror("fopen");
+      exit(1);
+    }
+    trace.ckptInterval = ckptInterval ? ckptInterval : CKPTINTERVAL;
+    trace.ckptNext = statePtr->cycles;
+    beginCheckpoints(trace.ckptFp, statePtr, memorySize);
+  }
+
+  if (serverMode) {
+    serve(statePtr, memorySize, ckptInterval ? ckptInterval : SNAPINTERVAL, socketPath);
+    return 0;
+  }
+
+  traceBegin(&trace, statePtr, memorySize);
+  double startTime = now();
+  simulate(statePtr, &trace, memorySize);
+	// printf("halting machine\n");
+  traceEnd(&trace, statePtr, memorySize);
+  if (trace.ckptFp != NULL) {
+    fclose(trace.ckptFp);
+  }
+  if (trace.format == TRACE_NONE) {
+    printSummary(statePtr, memorySize, now() - startTime);
+  }
+  if (reportPath != NULL) {
+    FILE *reportFp = fopen(reportPath, "w");
+    if (reportFp == NULL) {
+      printf("error: can't open file %s", reportPath);
+      perror("fopen");
+      exit(1);
+    }
+    writeReport(reportFp, statePtr);
+    fclose(reportFp);
+  }
+  if (statePtr->fault) {  // 输出可能是 trace, 错误信息写到标准错误
+    fprintf(stderr, "error: memory fault at address %u (pc %d, cycle %d)\n", statePtr->faultAddress,
+            statePtr->faultPC, statePtr->cycles);
+    return 1;
+  }
 
   return 0;
 }
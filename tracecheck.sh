@@ -0,0 +1,32 @@
+#!/bin/bash
+# Checks that tracereader.py reads the binary trace (tomasulo -f bin) back to
+# exactly the output of tomasulo -f text, for every sample program.
+#
+# usage: ./tracecheck.sh [tomasulo options, e.g. -p earlyresolve=1]
+
+set -e
+
+CC=${CC:-cc}
+PYTHON=${PYTHON:-python3}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$CC -O2 -o "$DIR/assembler" assembler.c
+$CC -O2 -pthread -o "$DIR/tomasulo" tomasulo.c
+
+fail=0
+for asm in sample/*.asm; do
+    name=$(basename "$asm" .asm)
+    "$DIR/assembler" "$asm" "$DIR/$name.txt" > /dev/null
+    "$DIR/tomasulo" -f text "$@" "$DIR/$name.txt" > "$DIR/$name.state"
+    "$DIR/tomasulo" -f bin -o "$DIR/$name.trace" "$@" "$DIR/$name.txt" > /dev/null
+    "$PYTHON" tracereader.py "$DIR/$name.trace" > "$DIR/$name.dump"
+    if cmp -s "$DIR/$name.state" "$DIR/$name.dump"; then
+        echo "ok      $name"
+    else
+        echo "differ  $name"
+        diff "$DIR/$name.state" "$DIR/$name.dump" | head -5
+        fail=1
+    fi
+done
+exit $fail
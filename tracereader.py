@@ -0,0 +1,376 @@
+import mmap
+import os
+import re
+import struct
+import sys
+
+MAGIC = b'TMTR'
+VERSION = 1
+INDEX_MAGIC = b'TMIX'
+INDEX_VERSION = 1
+KEYFRAME = ord('K')
+DELTA = ord('D')
+END = ord('E')
+
+RBFIELDS = 9
+RSFIELDS = 8
+BTFIELDS = 4
+REGFIELDS = 3
+
+regRegALU, HALT, J, NOOP, BEQZ, BNEZ, ADDI, ANDI, LW, SW = 0, 1, 2, 3, 4, 5, 8, 12, 35, 43
+SLTI, ORI, XORI, JR, JAL, SLLI, SRLI = 10, 13, 14, 18, 19, 20, 22
+FUNC_NAMES = {32: 'add', 34: 'sub', 36: 'and', 37: 'or', 38: 'xor', 42: 'slt',
+              4: 'sll', 6: 'srl', 24: 'mul', 26: 'div'}
+IMM_NAMES = {LW: 'lw', SW: 'sw', ADDI: 'addi', ANDI: 'andi', ORI: 'ori', XORI: 'xori',
+             SLTI: 'slti', SLLI: 'slli', SRLI: 'srli', BEQZ: 'beqz', BNEZ: 'bnez'}
+STATE_NAMES = ['ISSUING', 'EXECUTING', 'WRITINGRESULT', 'COMMTITTING']
+PRED_NAMES = ['STRONGNOT', 'WEAKTAKEN', 'WEAKNOT', 'STRONGTAKEN']
+
+
+def opcode(instr):
+    return (instr >> 26) & 0x3f
+
+
+def field0(instr):
+    return (instr >> 21) & 0x1f
+
+
+def field1(instr):
+    return (instr >> 16) & 0x1f
+
+
+def field2(instr):
+    return (instr >> 11) & 0x1f
+
+
+def immediate(instr):
+    imm = instr & 0xffff
+    return imm - 0x10000 if imm & 0x8000 else imm
+
+
+def jumpAddr(instr):
+    addr = instr & 0x3ffffff
+    return addr - 0x4000000 if addr & 0x2000000 else addr
+
+
+def isBranch(op):
+    return op == BEQZ or op == BNEZ
+
+
+def disassemble(instr):
+    op = opcode(instr)
+    if op == regRegALU:
+        name = FUNC_NAMES.get(instr & 0x7ff, 'alu')
+        return '%s %d %d %d ' % (name, field2(instr), field0(instr), field1(instr))
+    if op in IMM_NAMES:
+        return '%s %d %d %d' % (IMM_NAMES[op], field1(instr), field0(instr), immediate(instr))
+    if op == J:
+        return 'j %d' % jumpAddr(instr)
+    if op == JAL:
+        return 'jal %d' % jumpAddr(instr)
+    if op == JR:
+        return 'jr %d' % field0(instr)
+    if op == HALT:
+        return 'halt'
+    if op == NOOP:
+        return 'noop'
+    return 'data %d' % instr
+
+
+class Index:
+    """Record -> byte offset table; record `len(index)` is the end of the trace."""
+
+    def __init__(self, offsets):
+        self.offsets = offsets
+        self.count = len(offsets) - 1
+
+    def __len__(self):
+        return self.count
+
+    def __getitem__(self, i):
+        return self.offsets[i]
+
+
+class MappedIndex(Index):
+    """The index file written next to the trace (`tomasulo -i`), read through mmap."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, self.count = struct.unpack_from('<4sII', self.data, 0)
+        if magic != INDEX_MAGIC or version != INDEX_VERSION:
+            raise ValueError('%s is not a trace index' % path)
+        if len(self.data) < 12 + 8 * (self.count + 1):
+            raise ValueError('truncated trace index')
+
+    def __getitem__(self, i):
+        return struct.unpack_from('<Q', self.data, 12 + 8 * i)[0]
+
+
+def openIndex(path):
+    indexPath = path + '.idx'
+    if os.path.exists(indexPath) and os.path.getmtime(indexPath) >= os.path.getmtime(path):
+        return MappedIndex(indexPath)
+    return None
+
+
+def openTrace(path):
+    """Open a binary or text trace, using its index when one is present."""
+    with open(path, 'rb') as f:
+        binary = f.read(len(MAGIC)) == MAGIC
+    return Trace(path) if binary else TextTrace(path)
+
+
+class TextTrace:
+    """Random access to the trace written by `tomasulo -f text`."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.index = openIndex(path)
+        if self.index is None:
+            self.index = self.scan()
+        header = self.data[:self.index[0]].decode().splitlines()
+        self.instr = [line.split('=')[1] for line in header if line.startswith('instr=')]
+        self.total = int(self.data[self.index[len(self.index)]:])
+        # a run resumed from a checkpoint (tomasulo -l) starts at the checkpoint's cycle
+        self.first = int(self.data[self.index[0] + 6:self.data.find(b'\n', self.index[0])])
+        self.unitNames = self.scanUnitNames()
+
+    def scan(self):
+        """Build the index in memory when the simulator did not write one."""
+        offsets = []
+        pos = self.data.find(b'Cycle=')
+        while pos != -1:
+            offsets.append(pos)
+            pos = self.data.find(b'\nCycle=', pos)
+            if pos != -1:
+                pos += 1
+        last = self.data.rfind(b'\n') + 1
+        return Index(offsets + [last])
+
+    def scanUnitNames(self, limit=256):
+        """Reservation station names, taken from the ROB entries that point at them.
+
+        The text format only numbers the stations. A station that stays idle in
+        the first `limit` cycles is named after the one before it.
+        """
+        first = self.state(self.first)
+        names = ['RS%d' % i for i in range(len(first)) if 'RS%d-Busy' % i in first]
+        unknown = set(range(len(names)))
+        for cycle in range(self.first, min(self.first + limit, self.total + 1)):
+            if not unknown:
+                break
+            states = self.state(cycle)
+            for i in list(unknown):
+                if states.get('RS%d-Busy' % i) == '1':
+                    unit = states.get('RB%s-ExecUnit' % states['RS%d-ReorderNum' % i])
+                    if unit is not None:
+                        names[i] = unit
+                        unknown.discard(i)
+        # stations of a class are numbered consecutively: LOAD1, LOAD2, ...
+        for i in sorted(unknown):
+            prev = re.match(r'([A-Z]+)(\d+)$', names[i - 1]) if i > 0 else None
+            if prev:
+                names[i] = '%s%d' % (prev.group(1), int(prev.group(2)) + 1)
+        return names
+
+    def state(self, cycle):
+        """KEY=value pairs of `cycle`; the final cycle includes the state at halt."""
+        if cycle < self.first or cycle > self.total:
+            raise KeyError(cycle)
+        record = cycle - self.first
+        end = record + 1 if cycle < self.total else len(self.index)
+        lines = self.data[self.index[record]:self.index[end]].decode().splitlines()
+        states = {}
+        for line in lines:
+            if not line.startswith('Cycle='):
+                key, value = line.split('=')
+                states[key] = value
+        return states
+
+
+class Trace:
+    """Reads the binary trace written by `tomasulo -f bin`."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.pos = 0
+        if self.data[:4] != MAGIC:
+            raise ValueError('%s is not a binary trace' % path)
+        self.pos = 4
+        version = self.varint()
+        if version != VERSION:
+            raise ValueError('unsupported trace version %d' % version)
+        self.interval = self.varint()
+        self.rbSize = self.varint()
+        self.numUnits = self.varint()
+        self.btbSize = self.varint()
+        self.numRegs = self.varint()
+        self.memorySize = self.varint()
+        self.unitNames = []
+        for _ in range(self.numUnits):
+            n = self.varint()
+            self.unitNames.append(self.data[self.pos:self.pos + n].decode())
+            self.pos += n
+        self.instr = [self.signed() for _ in range(16, self.memorySize)]
+        self.rsBase = 1 + self.rbSize * RBFIELDS
+        self.btBase = self.rsBase + self.numUnits * RSFIELDS
+        self.regBase = self.btBase + self.btbSize * BTFIELDS
+        self.memBase = self.regBase + self.numRegs * REGFIELDS
+        self.numFields = self.memBase + self.memorySize
+        self.index = openIndex(path)
+        if self.index is None:
+            self.scan()
+        else:
+            self.pos = self.index[len(self.index)] + 1
+            self.total = self.varint()
+        # a run resumed from a checkpoint (tomasulo -l) starts at the checkpoint's cycle
+        self.pos = self.index[0] + 1
+        self.first = self.varint()
+
+    def varint(self):
+        value, shift = 0, 0
+        while True:
+            b = self.data[self.pos]
+            self.pos += 1
+            value |= (b & 0x7f) << shift
+            if b < 0x80:
+                return value
+            shift += 7
+
+    def signed(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+    def scan(self):
+        """Build the index in memory when the simulator did not write one."""
+        offsets = []
+        self.total = None
+        while self.pos < len(self.data):
+            kind = self.data[self.pos]
+            start = self.pos
+            self.pos += 1
+            cycle = self.varint()
+            if kind == END:
+                self.total = cycle
+                offsets.append(start)
+                break
+            offsets.append(start)
+            if kind == KEYFRAME:
+                for _ in range(self.numFields):
+                    self.varint()
+            else:
+                for _ in range(2 * self.varint()):
+                    self.varint()
+        if self.total is None:
+            raise ValueError('truncated trace')
+        self.index = Index(offsets)
+
+    def apply(self, record, fields):
+        self.pos = self.index[record]
+        kind = self.data[self.pos]
+        self.pos += 1
+        self.varint()
+        if kind == KEYFRAME:
+            for i in range(self.numFields):
+                fields[i] = self.signed()
+        else:
+            i = 0
+            for _ in range(self.varint()):
+                i += self.varint()
+                fields[i] = self.signed()
+
+    def fields(self, cycle):
+        """Return the raw field vector at the last record of `cycle`.
+
+        Record i holds cycle first + i, and the state at halt is repeated as
+        one extra record, so only the records since the last keyframe are read.
+        """
+        if cycle < self.first or cycle > self.total:
+            raise KeyError(cycle)
+        last = cycle - self.first if cycle < self.total else len(self.index) - 1
+        first = max(cycle - cycle % self.interval, self.first) - self.first
+        fields = [0] * self.numFields
+        for i in range(first, last + 1):
+            self.apply(i, fields)
+        return fields
+
+    def render(self, fields):
+        """Turn a field vector into the KEY=value pairs printed by the text format."""
+        out = []
+        for i in range(self.rbSize):
+            busy, instr, unit, status, valid, result, storeAddr, cmp, branchPC = \
+                fields[1 + i * RBFIELDS:1 + (i + 1) * RBFIELDS]
+            out.append(('RB%d-Busy' % i, busy))
+            if busy != 1:
+                continue
+            op = opcode(instr)
+            out.append(('RB%d-Instr' % i, instr))
+            if status != 3:
+                out.append(('RB%d-ExecUnit' % i, self.unitNames[unit]))
+            out.append(('RB%d-InstrStatus' % i, STATE_NAMES[status]))
+            if op == NOOP or op == HALT:
+                out.append(('RB%d-Valid' % i, 0))
+            else:
+                out.append(('RB%d-Valid' % i, valid))
+                if valid == 1:
+                    out.append(('RB%d-Result' % i, result))
+            if op == SW:
+                out.append(('RB%d-StoreAddress' % i, storeAddr))
+            if isBranch(op):
+                out.append(('RB%d-BranchCmp' % i, cmp))
+                out.append(('RB%d-BranchPC' % i, branchPC))
+        for i in range(self.numUnits):
+            base = self.rsBase + i * RSFIELDS
+            busy, instr, vj, vk, qj, qk, timeLeft, reorderNum = fields[base:base + RSFIELDS]
+            out.append(('RS%d-Busy' % i, busy))
+            if busy != 1:
+                continue
+            out.append(('RS%d-Instr' % i, instr))
+            if qj == -1:
+                out.append(('RS%d-Vj' % i, vj))
+            if qk == -1:
+                out.append(('RS%d-Vk' % i, vk))
+            out += [('RS%d-Qj' % i, qj), ('RS%d-Qk' % i, qk),
+                    ('RS%d-ExTimeLeft' % i, timeLeft), ('RS%d-ReorderNum' % i, reorderNum)]
+        for i in range(self.btbSize):
+            base = self.btBase + i * BTFIELDS
+            valid, branchPC, target, pred = fields[base:base + BTFIELDS]
+            if valid:
+                out += [('BT%d-Valid' % i, 1), ('BT%d-BranchPC' % i, branchPC),
+                        ('BT%d-BranchPred' % i, PRED_NAMES[pred]), ('BT%d-BranchTarget' % i, target)]
+            else:
+                out.append(('BT%d-Valid' % i, 0))
+        for i in range(self.numRegs):
+            base = self.regBase + i * REGFIELDS
+            value, valid, reorderNum = fields[base:base + REGFIELDS]
+            out += [('R%d-Value' % i, value), ('R%d-Valid' % i, valid)]
+            if valid == 0:
+                out.append(('R%d-ReorderNum' % i, reorderNum))
+        for i in range(self.memorySize):
+            out.append(('MEM%d-Value' % i, fields[self.memBase + i]))
+        return [(k, str(v)) for k, v in out]
+
+    def state(self, cycle):
+        return dict(self.render(self.fields(cycle)))
+
+    def dumpText(self, out):
+        """Write the same output as `tomasulo -f text`."""
+        for instr in self.instr:
+            out.write('code=%s\ninstr=%d\n' % (disassemble(instr), instr))
+        fields = [0] * self.numFields
+        for i in range(len(self.index)):
+            self.apply(i, fields)
+            out.write('Cycle=%d\n' % min(self.first + i, self.total))
+            for k, v in self.render(fields):
+                out.write('%s=%s\n' % (k, v))
+        out.write('%d' % self.total)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print('usage: %s <binary trace>' % sys.argv[0])
+        sys.exit(1)
+    Trace(sys.argv[1]).dumpText(sys.stdout)